@@ -53,20 +53,49 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *   tlb_setpid: set the current address space ID. Entries are only
+ *        matched if their PID field equals it. The functions above
+ *        leave the current PID alone.
  */
 
 void tlb_random(uint32_t entryhi, uint32_t entrylo);
 void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
+void tlb_setpid(uint32_t pid);
+
+/*
+ * Slot management on top of the above (arch/mips/vm/tlbshadow.c). Each
+ * CPU keeps a software copy of which of its slots hold entries, so a
+ * refill never has to read the TLB to find room. Entries must be
+ * loaded and removed through these for the copy to stay right; all of
+ * them must be called with interrupts off.
+ *
+ *   tlb_insert: write ENTRYHI/ENTRYLO into an unused slot, or if there
+ *        is none into the next slot in round-robin order. Returns true
+ *        if an unused slot was found. The same note about duplicates
+ *        as for tlb_random applies.
+ *
+ *   tlb_invalidate: clear slot SLOT (e.g. as found by tlb_probe).
+ *
+ *   tlb_invalidate_all: clear every slot on this CPU.
+ *
+ * tlb_write may still be used to replace the entry in a slot that is
+ * known to be in use.
+ */
+
+bool tlb_insert(uint32_t entryhi, uint32_t entrylo);
+void tlb_invalidate(int slot);
+void tlb_invalidate_all(void);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has support for a 6-bit address space ID (TLBHI_PID). dumbvm
+ * leaves it zero; the paged VM tags each entry with the ASID of its
+ * address space. TLBLO_GLOBAL is not used, and the bits that aren't
+ * assigned a meaning can be left zero.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,7 +107,8 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
@@ -101,5 +131,11 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of distinct address space IDs.
+ */
+
+#define NUM_ASID 64
+
 
 #endif /* _MIPS_TLB_H_ */
@@ -96,11 +96,16 @@
  * ram_stealmem can be used before ram_getsize is called to allocate
  * memory that cannot be freed later. This is intended for use early
  * in bootup before VM initialization is complete.
+ *
+ * ram_getfirstfree returns where free memory started at boot, before
+ * any ram_stealmem, for a VM system that wants to take over the stolen
+ * pages as well.
  */
 
 void ram_bootstrap(void);
 paddr_t ram_stealmem(unsigned long npages);
 void ram_getsize(paddr_t *lo, paddr_t *hi);
+paddr_t ram_getfirstfree(void);
 
 /*
  * TLB shootdown bits.
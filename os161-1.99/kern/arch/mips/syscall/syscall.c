@@ -34,6 +34,7 @@
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <copyinout.h>
 #include <syscall.h>
 
 
@@ -81,6 +82,10 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if !OPT_DUMBVM
+	int fd;
+	off_t offset;
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -115,6 +120,21 @@ syscall(struct trapframe *tf)
 			  (int)tf->tf_a2,
 			  (int *)(&retval));
 	  break;
+	case SYS_open:
+		err = sys_open((userptr_t)tf->tf_a0,
+			       (int)tf->tf_a1,
+			       (mode_t)tf->tf_a2,
+			       (int *)&retval);
+		break;
+	case SYS_read:
+		err = sys_read((int)tf->tf_a0,
+			       (userptr_t)tf->tf_a1,
+			       (unsigned int)tf->tf_a2,
+			       (int *)&retval);
+		break;
+	case SYS_close:
+		err = sys_close((int)tf->tf_a0);
+		break;
 	case SYS__exit:
 	  sys__exit((int)tf->tf_a0);
 	  /* sys__exit does not return, execution should not get here */
@@ -135,6 +155,33 @@ syscall(struct trapframe *tf)
 	case SYS_execv:
 		err = sys_execv((char *)tf->tf_a0, (char **) tf->tf_a1);
 		break;
+#if !OPT_DUMBVM
+	case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+		break;
+	case SYS_mmap:
+		/* fd and the 64-bit offset don't fit in registers */
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), &fd, sizeof(fd));
+		if (!err) {
+			err = copyin((const_userptr_t)(tf->tf_sp + 24),
+				     &offset, sizeof(offset));
+		}
+		if (!err) {
+			err = sys_mmap((userptr_t)tf->tf_a0,
+				       (size_t)tf->tf_a1,
+				       (int)tf->tf_a2,
+				       (int)tf->tf_a3,
+				       fd, offset,
+				       (vaddr_t *)&retval);
+		}
+		break;
+	case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+	case SYS_vmstat:
+		err = sys_vmstat((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+#endif
 #endif // UW
 
 	    /* Add stuff here */
@@ -187,6 +234,9 @@ enter_forked_process(struct trapframe *tf)
 {
 	struct trapframe newtf=*tf;
 
+	/* sys_fork kmalloc'd the copy for us */
+	kfree(tf);
+
 	newtf.tf_epc+=4;
 	newtf.tf_v0=0;
 	newtf.tf_a3=0;
@@ -37,8 +37,8 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
-
-void reset(unsigned long * value);
+#include <coremap.h>
+#include <uw-vmstats.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -47,164 +47,14 @@ void reset(unsigned long * value);
 
 // Note: Didn't implement paging, just segmentation
 
-struct frame {
-	int continuous_length;// A frame will only have a non-zero value for this if it is the first part of a continuous number of frames 
-	paddr_t phy_addr;
-	bool continuous; 	 // A frame involved in a continuous number of acquired frames will be true, even if it's continuous length is zero
-	int used;
-};
-
-struct coremap {
-	int size; //Number of frames
-	struct frame *frames;
-	paddr_t starting_point; 
-};
-
-void reset(unsigned long * value) {
-	*value = 0;
-}
-
-struct coremap master_core;
-bool has_not_run = true;
-
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
-/*
- * Wrap rma_stealmem in a spinlock.
- */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
-
 void
 vm_bootstrap(void)
 {
-	paddr_t low, high;
-	ram_getsize(&low, &high);
-
-	master_core.size = ((high - low)/PAGE_SIZE);
-
-	master_core.starting_point  = ROUNDUP(low + (sizeof(struct frame)*master_core.size ), PAGE_SIZE);
-	
-
-	master_core.frames = (struct frame *) PADDR_TO_KVADDR(low);
-
-	for (int i = 0; i < master_core.size; i++) {
-		master_core.frames[i].used = 0; // While loop to make true
-		master_core.frames[i].continuous = false;
-		master_core.frames[i].continuous_length = 0;
-		master_core.frames[i].phy_addr = low + (i * PAGE_SIZE);
-	}
-
-	int count = 0;
-	while ( master_core.frames[count].phy_addr < master_core.starting_point) {
-		master_core.frames[count].used = 1;
-		count++;
-	}
-
-	has_not_run = false;
-}
-
-static
-paddr_t
-getppages(unsigned long npages)
-{
-	//kprintf("Here\n");
-	if (has_not_run == true) {
-		paddr_t addr;
-
-		spinlock_acquire(&stealmem_lock);
-
-		addr = ram_stealmem(npages);
-		
-		spinlock_release(&stealmem_lock);
-		//kprintf("Here again B1\n");
-
-		return addr;
-	}
-
-	else {
-		paddr_t addr;
-
-		spinlock_acquire(&stealmem_lock);
-
-
-		unsigned long page_count = 0;
-		int count = 0;
-		while (count < master_core.size) {
-			if (master_core.frames[count].used == 1) {
-				reset(&page_count);
-				count++;
-				//kprintf("Here again - Within A3\n");
-				continue;
-			} 
-			
-			//kprintf("Here again - Within A1\n");
-			page_count++;
-
-			if (page_count == npages) {
-
-				master_core.frames[count - page_count + 1].continuous_length = (int)page_count - 1;
-				int selected_pages_counter = count - page_count + 1;
-				while (selected_pages_counter < count + 1) {
-				//	kprintf("Here again - Within A2\n");
-					master_core.frames[selected_pages_counter].continuous = true;
-					master_core.frames[selected_pages_counter].used = 1;
-					selected_pages_counter ++;
-				}
-
-				addr = master_core.frames[count - page_count + 1].phy_addr;
-				break;
-
-			}
-			count++;
-		}
-
-
-		
-		spinlock_release(&stealmem_lock);
-	//	kprintf("Here again B2\n");
-		return addr;
-
-	}
-}
-
-/* Allocate/free some kernel-space virtual pages */
-vaddr_t 
-alloc_kpages(int npages)
-{
-	paddr_t pa;
-	pa = getppages(npages);
-	if (pa==0) {
-		return 0;
-	}
-	return PADDR_TO_KVADDR(pa);
-}
-
-void 
-free_kpages(vaddr_t addr)
-{
-	/* nothing - leak the memory. */
-
-	spinlock_acquire(&stealmem_lock);
-
-	//kprintf("Made it\n");
-
-	int counter = 0;
-
-	paddr_t real_address = addr - MIPS_KSEG0;
-	while (counter < master_core.size) {
-		if(master_core.frames[counter].phy_addr == real_address) { break; }
-		counter++;
-	}
-
-	for(int i = counter; i <= master_core.frames[counter].continuous_length + counter; i++) {
-		master_core.frames[i].used = 0;
-		master_core.frames[i].continuous = false;
-
-		//master_core.frames[i].continuous_length = 0;
-	}
-
-	spinlock_release(&stealmem_lock);
+	coremap_bootstrap();
+	vmstats_init();
 }
 
 void
@@ -225,7 +75,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
-	int i;
+	bool freeslot;
 	uint32_t ehi, elo;
 	struct addrspace *as;
 	int spl;
@@ -304,49 +154,25 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
-	int NUM_TAB_PLUS = NUM_TLB + 1;
-	for (i=0; i<NUM_TAB_PLUS ; i++) {
-		
-		if ( i + 1 != NUM_TAB_PLUS) {
-			tlb_read(&ehi, &elo, i);
-			if (elo & TLBLO_VALID) {
-				continue;
-			}
-			ehi = faultaddress;
-
-			if( (faultaddress >= vbase1 && faultaddress < vtop1) && (as->elf_loaded == 1)) {
-				elo  = (paddr | TLBLO_VALID) & ~TLBLO_DIRTY;
-			}	
-			else {
-				elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-			}
-			DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-			tlb_write(ehi, elo, i);
-			splx(spl);
-			return 0;
-		}
-		else {
-			ehi = faultaddress;
-
-			if((faultaddress >= vbase1 && faultaddress < vtop1) && (as->elf_loaded == 1)) {
-				elo = (paddr | TLBLO_VALID) & ~TLBLO_DIRTY;
-			}	
-			else {
-				elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-			}
-			
-		//	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-			tlb_random(ehi, elo);
-			splx(spl);
-			return 0;
-		}
-
+	ehi = faultaddress;
+	if ((faultaddress >= vbase1 && faultaddress < vtop1) &&
+	    as->elf_loaded == 1) {
+		elo = (paddr | TLBLO_VALID) & ~TLBLO_DIRTY;
 	}
+	else {
+		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+	}
+
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	freeslot = tlb_insert(ehi, elo);
+	splx(spl);
 
-	// Should never get here
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
-	splx(spl); 
-	return EFAULT; 
+	/* Everything is resident, so every miss is a reload */
+	vmstats_inc(VMSTAT_TLB_FAULT);
+	vmstats_inc(VMSTAT_TLB_RELOAD);
+	vmstats_inc(freeslot ? VMSTAT_TLB_FAULT_FREE :
+		    VMSTAT_TLB_FAULT_REPLACE);
+	return 0;
 }
 
 struct addrspace *
@@ -372,16 +198,16 @@ as_create(void)
 void
 as_destroy(struct addrspace *as)
 {
-	free_kpages(as->as_pbase1 + MIPS_KSEG0);
-	free_kpages(as->as_pbase2 + MIPS_KSEG0 );
-	free_kpages(  as->as_stackpbase + MIPS_KSEG0);
+	freeppages(as->as_pbase1);
+	freeppages(as->as_pbase2);
+	freeppages(as->as_stackpbase);
 	kfree(as);
 }
 
 void
 as_activate(void)
 {
-	int i, spl;
+	int spl;
 	struct addrspace *as;
 
 	as = curproc_getas();
@@ -395,9 +221,7 @@ as_activate(void)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
+	tlb_invalidate_all();
 
 	splx(spl);
 }
@@ -109,6 +109,17 @@ ram_stealmem(unsigned long npages)
 	return paddr;
 }
 
+/*
+ * Return the first physical address that was free at boot, before
+ * anything was stolen with ram_stealmem. A VM system that takes over
+ * the stolen pages too manages memory from here up.
+ */
+paddr_t
+ram_getfirstfree(void)
+{
+	return firstfree - MIPS_KSEG0;
+}
+
 /*
  * This function is intended to be called by the VM system when it
  * initializes in order to find out what memory it has available to
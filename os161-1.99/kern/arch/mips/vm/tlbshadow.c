@@ -0,0 +1,94 @@
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <platform/maxcpus.h>
+#include <mips/tlb.h>
+
+/*
+ * Software copy of which TLB slots are in use on each CPU, so that a
+ * refill can pick its slot without reading the TLB back.
+ *
+ * After a reset slots are handed out in order from 0 up to ts_fill.
+ * Slots below ts_fill that have been invalidated since are kept on a
+ * stack (ts_holes) and reused first. Once every slot is in use the
+ * victim is chosen round-robin by ts_hand. All of it starts out zero,
+ * which matches the empty TLB start.S leaves with tlb_reset.
+ */
+struct tlbshadow {
+	uint32_t ts_used[NUM_TLB / 32];	/* bit per slot: holds an entry */
+	uint8_t ts_holes[NUM_TLB];	/* freed slots below ts_fill */
+	unsigned ts_nholes;
+	unsigned ts_fill;		/* slots from here up are unused */
+	unsigned ts_hand;		/* next victim once all are used */
+};
+
+static struct tlbshadow tlbshadows[MAXCPUS];
+
+#define TS_ISUSED(ts, i)  (((ts)->ts_used[(i) / 32] >> ((i) % 32)) & 1)
+#define TS_SETUSED(ts, i) ((ts)->ts_used[(i) / 32] |= (uint32_t)1 << ((i) % 32))
+#define TS_CLRUSED(ts, i) ((ts)->ts_used[(i) / 32] &= ~((uint32_t)1 << ((i) % 32)))
+
+/*
+ * This CPU's shadow. Interrupts must be off so that we stay on this
+ * CPU and nothing else touches the TLB under us.
+ */
+static
+struct tlbshadow *
+tlbshadow_get(void)
+{
+	KASSERT(curthread->t_iplhigh_count > 0);
+	KASSERT(curcpu->c_number < MAXCPUS);
+	return &tlbshadows[curcpu->c_number];
+}
+
+bool
+tlb_insert(uint32_t entryhi, uint32_t entrylo)
+{
+	struct tlbshadow *ts = tlbshadow_get();
+	unsigned slot;
+	bool wasfree = true;
+
+	if (ts->ts_nholes > 0) {
+		slot = ts->ts_holes[--ts->ts_nholes];
+	}
+	else if (ts->ts_fill < NUM_TLB) {
+		slot = ts->ts_fill++;
+	}
+	else {
+		slot = ts->ts_hand;
+		ts->ts_hand = (ts->ts_hand + 1) % NUM_TLB;
+		wasfree = false;
+	}
+
+	KASSERT(wasfree == !TS_ISUSED(ts, slot));
+	TS_SETUSED(ts, slot);
+	tlb_write(entryhi, entrylo, slot);
+	return wasfree;
+}
+
+void
+tlb_invalidate(int slot)
+{
+	struct tlbshadow *ts = tlbshadow_get();
+
+	KASSERT(slot >= 0 && slot < NUM_TLB);
+	tlb_write(TLBHI_INVALID(slot), TLBLO_INVALID(), slot);
+	if (TS_ISUSED(ts, slot)) {
+		TS_CLRUSED(ts, slot);
+		ts->ts_holes[ts->ts_nholes++] = slot;
+	}
+}
+
+void
+tlb_invalidate_all(void)
+{
+	struct tlbshadow *ts = tlbshadow_get();
+	unsigned i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	bzero(ts, sizeof(*ts));
+}
@@ -842,8 +842,9 @@ static
 int
 emufs_mmap(struct vnode *v)
 {
+	/* Mapped pages are read and written with emufs_read/emufs_write */
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 //////////////////////////////
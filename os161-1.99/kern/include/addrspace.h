@@ -36,8 +36,12 @@
 
 
 #include <vm.h>
+#include <array.h>
+#include <asid.h>
+#include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
 
 
 /* 
@@ -47,6 +51,7 @@ struct vnode;
  * You write this.
  */
 
+#if OPT_DUMBVM
 struct addrspace {
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
@@ -57,6 +62,76 @@ struct addrspace {
   paddr_t as_stackpbase;
   bool elf_loaded;
 };
+#else
+
+/*
+ * The user stack grows down from USERSTACK, a page at a time as it is
+ * touched, up to this many pages (1MB). It also stops one page short
+ * of the highest region.
+ */
+#define VM_STACKMAXPAGES 256
+
+/*
+ * mmap() places mappings top-down from here, a guard page below the
+ * largest possible stack. The heap grows up towards them.
+ */
+#define VM_MMAPTOP  (USERSTACK - (VM_STACKMAXPAGES + 1) * PAGE_SIZE)
+
+/*
+ * Fault-around window in pages: a TLB miss also loads entries for the
+ * resident pages in the aligned block of this many pages around it.
+ * 0 or 1 turns it off; otherwise a power of two up to
+ * VM_FAULTAROUND_MAX. Set from the menu with "fa".
+ */
+#define VM_FAULTAROUND_MAX 16
+extern unsigned vm_faultaround;
+
+/*
+ * Pages of a region are filled on first touch: the part that overlaps
+ * [rg_filevbase, rg_filevbase + rg_filesize) is read from rg_vnode at
+ * rg_offset onwards, and the rest is zeroed.
+ *
+ * rg_prot holds the PROT_* permissions from <kern/mman.h>. The MIPS
+ * TLB can only refuse writes, so a region that is not writeable but
+ * has any other permission can be read and executed; only PROT_NONE
+ * regions refuse every access.
+ *
+ * Regions made by mmap have rg_mmapflags set. Dirty pages of a
+ * MAP_SHARED region are written back to the file when they are paged
+ * out or unmapped, rather than going to swap.
+ */
+struct region {
+  vaddr_t rg_vbase;		/* page-aligned start */
+  size_t rg_npages;		/* length in pages */
+  int rg_prot;			/* PROT_READ | PROT_WRITE | PROT_EXEC */
+  vaddr_t rg_filevbase;		/* where the file-backed part starts */
+  size_t rg_filesize;		/* bytes backed by the file (0 = none) */
+  off_t rg_offset;		/* file offset of rg_filevbase */
+  struct vnode *rg_vnode;	/* file backing the region, if any */
+  int rg_mmapflags;		/* MAP_SHARED or MAP_PRIVATE; 0 if from the ELF loader */
+};
+
+/* First address past the end of region RG */
+#define RG_END(rg)  ((rg)->rg_vbase + (rg)->rg_npages * PAGE_SIZE)
+
+/*
+ * The regions (from the ELF loader and from mmap) are kept in an array
+ * sorted by address, so that as_region can binary-search it. The
+ * region found last is checked first, since faults tend to come in
+ * runs on the same region.
+ */
+struct addrspace {
+  struct array as_regions;	/* struct region *, sorted by rg_vbase */
+  struct region *as_lasthit;	/* region as_region returned last */
+  vaddr_t as_stackbase;		/* lowest stack page touched so far */
+  vaddr_t as_heapbase;		/* heap starts after the highest region */
+  vaddr_t as_heaptop;		/* current break, moved by sbrk */
+  unsigned as_asid[ASID_MAXCPUS];	/* TLB address space ID per CPU, see asid.h */
+  uint32_t as_cpumask;		/* CPUs that may hold TLB entries for us */
+  struct pagetable *as_pt;	/* resident pages, see pagetable.h */
+  bool elf_loaded;		/* as_complete_load has been called */
+};
+#endif
 
 /*
  * Functions in addrspace.c:
@@ -92,6 +167,36 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_file - (paged VM only) record that FILESIZE bytes at
+ *                VADDR come from offset OFFSET of the executable V.
+ *                Nothing is read until the pages are faulted in. The
+ *                address space holds a reference to V.
+ *
+ *    as_sbrk   - (paged VM only) move the end of the heap by AMOUNT
+ *                bytes and hand back the old end in *OLDBREAK. Pages
+ *                are zero-filled on first touch; pages given back are
+ *                freed.
+ *
+ *    as_mmap   - (paged VM only) map LEN bytes of V from OFFSET, of
+ *                which FILESIZE exist in the file, with MAP_* FLAGS.
+ *                Picks the address and returns it in *VADDR. Pages
+ *                are read in as they are faulted on. The mapping holds
+ *                a reference to V.
+ *
+ *    as_munmap - (paged VM only) remove the mappings that lie in
+ *                [VADDR, VADDR + LEN), writing dirty shared pages back
+ *                to their files.
+ *
+ *    as_region - (paged VM only) return the region containing VADDR,
+ *                or NULL. Takes O(log n) in the number of regions, or
+ *                O(1) if it is the same region as last time.
+ *
+ *    as_writepage - (paged VM only) write the frame at PADDR back to
+ *                the part of RG's file that page VADDR maps.
+ *
+ *    as_countpages - (paged VM only) count the pages of AS that are
+ *                resident and that are in swap. Caller holds vm_lock.
  */
 
 struct addrspace *as_create(void);
@@ -108,6 +213,22 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if !OPT_DUMBVM
+int               as_define_file(struct addrspace *as, struct vnode *v,
+                                 vaddr_t vaddr, off_t offset,
+                                 size_t filesize);
+int               as_sbrk(struct addrspace *as, int amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, struct vnode *v,
+                          size_t len, int prot, int flags, off_t offset,
+                          off_t filesize, vaddr_t *vaddr);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+struct region    *as_region(struct addrspace *as, vaddr_t vaddr);
+int               as_writepage(struct region *rg, vaddr_t vaddr,
+                               paddr_t paddr);
+void              as_countpages(struct addrspace *as, unsigned *resident,
+                                unsigned *swapped);
+#endif
 
 
 /*
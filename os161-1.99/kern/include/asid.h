@@ -0,0 +1,49 @@
+#ifndef _ASID_H_
+#define _ASID_H_
+
+/*
+ * Address space IDs for the paged VM system.
+ *
+ * Each address space is tagged with one of the NUM_ASID hardware IDs,
+ * so TLB entries for several address spaces can sit in the TLB at once
+ * and a context switch no longer has to flush it. IDs are handed out
+ * per CPU, in generations: once all of a CPU's IDs are in use, its
+ * generation number goes up, its TLB is flushed, and every address
+ * space picks up a new ID the next time it is activated there.
+ *
+ * An address space also keeps a mask of the CPUs it has an ID on,
+ * i.e. the ones that may hold TLB entries for it. Changing a mapping
+ * has to shoot the old entry down on all of those.
+ *
+ *    asid_activate - make AS the current address space on this CPU,
+ *                    giving it an ID first if its one is stale.
+ *
+ *    asid_flush    - discard every TLB entry belonging to AS by giving
+ *                    up its IDs. AS must not be running on any other
+ *                    CPU (true of single-threaded processes).
+ *
+ *    asid_entryhi  - TLB EntryHi value for VADDR in AS, which must be
+ *                    the active address space on this CPU.
+ *
+ *    asid_tlb_drop - remove the TLB entry for VADDR in AS on this CPU
+ *                    only. Safe to call with spinlocks held.
+ *
+ *    asid_shootdown - remove the TLB entries for the N pages in VADDRS
+ *                    of AS on every CPU, and wait until that is done.
+ *                    Must not be called with spinlocks held.
+ */
+
+/* Enough for every CPU sys161 supports */
+#define ASID_MAXCPUS 32
+
+struct addrspace;
+
+void     asid_activate(struct addrspace *as);
+void     asid_flush(struct addrspace *as);
+uint32_t asid_entryhi(struct addrspace *as, vaddr_t vaddr);
+void     asid_tlb_drop(struct addrspace *as, vaddr_t vaddr);
+void     asid_shootdown(struct addrspace *as, const vaddr_t *vaddrs,
+			unsigned n);
+
+
+#endif /* _ASID_H_ */
@@ -0,0 +1,79 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+struct addrspace;
+
+/*
+ * Coremap - physical page (frame) allocator.
+ *
+ * This is shared by dumbvm and the paged VM system; whichever one is
+ * configured calls coremap_bootstrap from vm_bootstrap.
+ *
+ *    coremap_bootstrap - take over all physical memory. Before this is
+ *                called getppages falls back to ram_stealmem; what it
+ *                stole is taken over as allocated and can be freed.
+ *
+ *    getppages - allocate NPAGES physically contiguous frames. The
+ *                request is rounded up to a power of two. Returns 0 if
+ *                no block that large is free.
+ *
+ *    freeppages - drop a reference to a run previously returned by
+ *                getppages. The run is released once nothing refers
+ *                to it any more.
+ *
+ *    coremap_incref - add a reference to the run at PADDR, for
+ *                sharing a frame copy-on-write.
+ *
+ *    coremap_refcount - return the number of references to the run at
+ *                PADDR.
+ *
+ *    coremap_mapped - note that vm_fault has just mapped PADDR at VADDR
+ *                in AS. This marks the frame recently used and, if it
+ *                is not shared, makes it a candidate for paging out.
+ *
+ *    coremap_victim - pick a user frame to page out using the clock
+ *                algorithm. Returns its address and the page it holds
+ *                in *AS and *VADDR, or 0 if nothing can be evicted.
+ *                The frame stays allocated but loses its owner; the
+ *                caller pages it out and then calls freeppages.
+ *                DROP is called (with the coremap locked) to remove
+ *                the TLB entry for a page whose reference bit the
+ *                clock hand clears.
+ *
+ *    coremap_settag - attach TAG to every frame of the block at PADDR,
+ *                which the caller allocated for kernel use, or remove
+ *                it if TAG is NULL. Remove it before freeing a block
+ *                of more than one frame; a single frame loses its tag
+ *                when it is freed.
+ *
+ *    coremap_gettag - return the tag of the frame at PADDR, or NULL if
+ *                it has none. Takes no lock, so the caller must own
+ *                the frame.
+ *
+ *    coremap_nframes - return the number of frames it manages.
+ *
+ *    coremap_nfree - return the number of free frames.
+ *
+ *    coremap_printstats - print the number of free blocks of each size,
+ *                to show how fragmented physical memory is.
+ *
+ * alloc_kpages/free_kpages (see vm.h) are thin wrappers that convert
+ * to and from kernel virtual addresses.
+ */
+
+void    coremap_bootstrap(void);
+paddr_t getppages(unsigned long npages);
+void    freeppages(paddr_t paddr);
+void    coremap_incref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void    coremap_mapped(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+paddr_t coremap_victim(void (*drop)(struct addrspace *, vaddr_t),
+		       struct addrspace **as, vaddr_t *vaddr);
+void    coremap_settag(paddr_t paddr, void *tag);
+void   *coremap_gettag(paddr_t paddr);
+unsigned coremap_nframes(void);
+unsigned coremap_nfree(void);
+void    coremap_printstats(void);
+
+
+#endif /* _COREMAP_H_ */
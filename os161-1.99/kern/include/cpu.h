@@ -59,6 +59,7 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Destroyed threads, with stacks */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 
 	/*
@@ -86,6 +87,7 @@ struct cpu {
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	uint32_t c_shootdowns_done;	/* Shootdown IPIs handled so far */
 	struct spinlock c_ipi_lock;
 };
 
@@ -152,6 +154,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_wait sends the N shootdowns in MAPPINGS to each
+ * other CPU whose bit (1 << c_number) is set in CPUMASK, and then
+ * waits until all of them have done them. It must not be called with
+ * spinlocks held, since the targets may be waiting on us in turn.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +172,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_wait(uint32_t cpumask,
+			   const struct tlbshootdown *mappings, unsigned n);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,57 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and per-process file tables.
+ *
+ * An open file is a vnode plus the offset and access mode it was opened
+ * with. After fork parent and child share the same open file (and so
+ * its offset), which is why it is reference counted.
+ *
+ * Descriptors 0-2 are not in the table: the console is still written
+ * through proc->console (see sys_write), so open() hands out
+ * descriptors from 3 up.
+ *
+ *    file_open  - open PATH with the O_* FLAGS and MODE and put it in
+ *                 the lowest free slot of the current process's table.
+ *                 Returns the descriptor in *FD. PATH may be modified
+ *                 (as by vfs_open).
+ *
+ *    file_get   - return the open file for descriptor FD of the current
+ *                 process, or EBADF.
+ *
+ *    file_close - remove FD from the current process's table and drop
+ *                 the reference to its open file.
+ *
+ *    filetable_copy    - give child process TO the same open files as
+ *                        FROM. Used by fork.
+ *
+ *    filetable_destroy - close everything PROC still has open.
+ */
+
+#include <limits.h>
+
+struct proc;
+struct vnode;
+struct lock;
+
+/* First descriptor handed out by open() */
+#define FD_FIRST 3
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_accmode;			/* O_RDONLY, O_WRONLY or O_RDWR */
+	off_t of_offset;		/* for read() and write() */
+	unsigned of_refcount;		/* descriptors referring to this */
+	struct lock *of_lock;		/* protects of_offset and of_refcount */
+};
+
+int  file_open(char *path, int flags, mode_t mode, int *fd);
+int  file_get(int fd, struct openfile **ret);
+int  file_close(int fd);
+
+void filetable_copy(struct proc *from, struct proc *to);
+void filetable_destroy(struct proc *proc);
+
+
+#endif /* _FILE_H_ */
@@ -0,0 +1,19 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap().
+ */
+
+/* Page protections (the prot argument); any combination */
+#define PROT_NONE     0      /* No access (not supported) */
+#define PROT_READ     1      /* Pages may be read */
+#define PROT_WRITE    2      /* Pages may be written */
+#define PROT_EXEC     4      /* Pages may be executed */
+
+/* Sharing (the flags argument); exactly one of these */
+#define MAP_SHARED    1      /* Writes go back to the file */
+#define MAP_PRIVATE   2      /* Writes are private to the process */
+
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,30 @@
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * What vmstat() returns about a process, or with pid 0 about the
+ * whole system. The event counts run from when the process was
+ * created (or the system booted); the page counts are as of the call.
+ */
+
+#define VMSTAT_NAMELEN  16   /* including the terminating null */
+
+struct vmstat {
+	pid_t vs_pid;                   /* process, or 0 for the system */
+	char vs_name[VMSTAT_NAMELEN];   /* program name, maybe truncated */
+
+	/* Events */
+	__u32 vs_tlbfaults;     /* TLB misses taken */
+	__u32 vs_tlbreloads;    /* ... where the page was already resident */
+	__u32 vs_zerofaults;    /* ... filled with zeroes */
+	__u32 vs_filefaults;    /* ... read from the executable or a file */
+	__u32 vs_swapins;       /* ... read back from swap */
+	__u32 vs_sharedfaults;  /* ... found in the text cache */
+	__u32 vs_swapouts;      /* pages written to swap to make room */
+
+	/* Pages */
+	__u32 vs_resident;      /* in memory */
+	__u32 vs_swapped;       /* in swap */
+};
+
+#endif /* _KERN_VMSTAT_H_ */
@@ -0,0 +1,64 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+#include <spinlock.h>
+
+/*
+ * Caches of objects of one type that are kept constructed between
+ * uses.
+ *
+ * The constructor runs when an object is first made and the
+ * destructor when it is finally given back to kmalloc; in between,
+ * kmem_cache_free and kmem_cache_alloc hand the object out again as
+ * it was left. So whatever the constructor sets up (wait channels,
+ * locks, arrays) is only paid for once, and anything freed to the
+ * cache must be back in its constructed state. The constructor
+ * returns 0 or an error code; either function may be NULL.
+ *
+ * A cache keeps at most KC_LIMIT free objects; past that, freed
+ * objects are destroyed.
+ *
+ *    kmem_cache_create - make a cache of SIZE-byte objects. Returns
+ *                  NULL if out of memory. NAME should be a string
+ *                  constant.
+ *
+ *    kmem_cache_destroy - destroy the free objects and the cache. All
+ *                  objects must have been freed.
+ *
+ *    kmem_cache_alloc - return an object, or NULL if out of memory or
+ *                  the constructor failed.
+ *
+ *    kmem_cache_free - hand an object back.
+ *
+ * Caches needed from the very start of boot, such as the ones for
+ * locks and threads, can be defined statically with
+ * KMEM_CACHE_INITIALIZER instead of being created.
+ */
+
+struct kmem_obj;	/* Opaque */
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* size of an object */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+	struct spinlock kc_lock;	/* protects the fields below */
+	struct kmem_obj *kc_free;	/* free objects, constructed */
+	unsigned kc_nfree;
+	unsigned kc_nalloc;		/* objects handed out */
+};
+
+#define KC_LIMIT 32
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) \
+	{ name, size, ctor, dtor, SPINLOCK_INITIALIZER, NULL, 0, 0 }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+
+#endif /* _KMEM_CACHE_H_ */
@@ -122,10 +122,14 @@ uint32_t random(void);
 /*
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
+ * kheap_bootstrap is called by coremap_bootstrap.
+ * kheap_printprofile only exists with "options khprof".
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
 void kheap_printstats(void);
+void kheap_printprofile(void);
+void kheap_bootstrap(void);
 
 /*
  * C string functions. 
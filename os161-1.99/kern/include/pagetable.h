@@ -0,0 +1,75 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for the paged VM system.
+ *
+ * The top level is an array of pointers to second-level tables; each
+ * second-level table is one page holding 1024 page table entries, so
+ * it maps 4MB of user address space. Second-level tables are only
+ * allocated once a page in their range is touched.
+ *
+ * A page table entry holds the physical frame in its top 20 bits and
+ * flags in the low bits. After fork, parent and child point at the
+ * same frames with PTE_COW set; the first write to such a page gets
+ * a private copy (see vm_fault).
+ *
+ * A page that has been paged out has PTE_SWAPPED instead of PTE_VALID,
+ * and the top bits hold its swap slot. An entry with neither flag has
+ * never been touched (or was clean when evicted) and is refilled from
+ * the executable or with zeroes.
+ */
+
+#include <vm.h>
+
+struct lock;
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME    0xfffff000	/* physical frame of a resident page */
+#define PTE_VALID    0x00000001	/* page is resident */
+#define PTE_COW      0x00000002	/* frame is shared; copy before writing */
+#define PTE_DIRTY    0x00000004	/* written since it was filled */
+#define PTE_SWAPPED  0x00000008	/* page is in swap, not resident */
+
+#define PTE_SLOT(pte)    ((pte) >> PT_L2_SHIFT)
+#define PTE_MKSWAP(slot) (((pte_t)(slot) << PT_L2_SHIFT) | PTE_SWAPPED)
+
+#define PT_L1_SHIFT    22
+#define PT_L2_SHIFT    12
+#define PT_L1_ENTRIES  (USERSPACETOP >> PT_L1_SHIFT)
+#define PT_L2_ENTRIES  (PAGE_SIZE / sizeof(pte_t))
+
+#define PT_L1_INDEX(va)  ((va) >> PT_L1_SHIFT)
+#define PT_L2_INDEX(va)  (((va) >> PT_L2_SHIFT) & (PT_L2_ENTRIES - 1))
+#define PT_VADDR(l1, l2) (((vaddr_t)(l1) << PT_L1_SHIFT) | \
+			  ((vaddr_t)(l2) << PT_L2_SHIFT))
+
+struct pagetable {
+	pte_t *pt_dir[PT_L1_ENTRIES];
+};
+
+/*
+ * Pageout can change the entries of any address space, so all page
+ * table entries are protected by this one lock (created in vm.c).
+ */
+extern struct lock *vm_lock;
+
+/*
+ *    pt_create  - allocate an empty page table. Returns NULL if out
+ *                 of memory.
+ *
+ *    pt_destroy - free the page table itself. The caller is expected
+ *                 to have released any frames the entries refer to.
+ *
+ *    pt_lookup  - return a pointer to the entry for VADDR. If the
+ *                 second-level table does not exist it is allocated
+ *                 when CREATE is true; otherwise NULL is returned.
+ *                 Also returns NULL if allocation fails.
+ */
+struct pagetable *pt_create(void);
+void              pt_destroy(struct pagetable *pt);
+pte_t            *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+
+
+#endif /* _PAGETABLE_H_ */
@@ -38,22 +38,20 @@
 
 #include <array.h>
 #include <types.h>
+#include <limits.h>
 #include <synch.h>
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include <uw-vmstats.h>
 
 struct addrspace;
 struct vnode;
+struct openfile;
 #ifdef UW
 struct semaphore;
 #endif // UW
 
 
-void givepid(struct proc *proc);
-struct array *allprocesses;                              
-struct lock*  pidlock;
-struct lock * pidlock2;
-
 /*
  * Process structure.
  */
@@ -75,11 +73,13 @@ struct proc {
      system calls, since each process will need to keep track of all files
      it has opened, not just the console. */
   struct vnode *console;                /* a vnode for the console device */
+  struct openfile *p_files[OPEN_MAX];   /* files opened with open(), see file.h */
 #endif
 
 	/* add more material here as needed */
 
-	pid_t myid;
+	pid_t myid;			/* 0 until it has one */
+	struct proc *p_parent;		/* NULL once exited or collected */
 	struct array *mykids;
 	
 	struct lock *exitinglock;
@@ -88,6 +88,9 @@ struct proc {
 	int exitcode;
 	bool exited;
 
+	/* VM events charged to this process; see _vmstats_inc */
+	unsigned p_vmstats[VMSTAT_COUNT];
+
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
@@ -103,6 +106,7 @@ void proc_bootstrap(void);
 
 /* Create a fresh process for use by runprogram(). */
 struct proc *proc_create_runprogram(const char *name);
+int proc_create_user(const char *name, struct proc **ret);
 
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
@@ -113,6 +117,16 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/*
+ * Process table. proc_getchild finds the child of PARENT with pid PID,
+ * failing with ESRCH or ECHILD. proc_next returns the live process
+ * with the lowest pid that is at least PID, or NULL; the caller must
+ * hold pidlock, which keeps it from being destroyed.
+ */
+extern struct lock *pidlock;
+int proc_getchild(struct proc *parent, pid_t pid, struct proc **ret);
+struct proc *proc_next(pid_t pid);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
@@ -0,0 +1,43 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space for the paged VM system.
+ *
+ * Pages are written to a raw disk device in page-sized slots. Slots
+ * are handed out from a bitmap. If the device cannot be opened the
+ * system runs without swap and user allocations simply fail when
+ * memory runs out.
+ *
+ *    swap_bootstrap - open SWAP_DEVICE and size the slot bitmap.
+ *
+ *    swap_enabled - true if there is a swap device.
+ *
+ *    swap_alloc - reserve a free slot. Returns ENOSPC if swap is full.
+ *
+ *    swap_free - release a slot.
+ *
+ *    swap_used - number of slots in use.
+ *
+ *    swap_in   - read slot SLOT into the frame at PADDR.
+ *
+ *    swap_out  - write the frame at PADDR to slot SLOT.
+ *
+ *    swap_copy - allocate a new slot holding a copy of slot SLOT and
+ *                return it in *NEWSLOT. Used by fork.
+ */
+
+/* Raw device to swap to (the second disk in sys161.conf) */
+#define SWAP_DEVICE "lhd1raw:"
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int  swap_alloc(unsigned *slot);
+void swap_free(unsigned slot);
+unsigned swap_used(void);
+int  swap_in(unsigned slot, paddr_t paddr);
+int  swap_out(unsigned slot, paddr_t paddr);
+int  swap_copy(unsigned slot, unsigned *newslot);
+
+
+#endif /* _SWAP_H_ */
@@ -72,8 +72,12 @@ void V(struct semaphore *);
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
  */
+/* Names shorter than this are kept in the lock or cv itself */
+#define SYNCH_NAMELEN 16
+
 struct lock {
         char *lk_name;
+        char lk_namebuf[SYNCH_NAMELEN];
         struct spinlock splock;
         struct wchan *wc;
         volatile bool locked;
@@ -116,6 +120,7 @@ void lock_destroy(struct lock *);
 
 struct cv {
         char *cv_name;
+        char cv_namebuf[SYNCH_NAMELEN];
         
         struct wchan *wc;
 };
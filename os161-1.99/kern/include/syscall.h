@@ -30,6 +30,8 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 
+#include "opt-dumbvm.h"
+
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -60,6 +62,9 @@ int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_open(userptr_t path, int flags, mode_t mode, int *retval);
+int sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval);
+int sys_close(int fdesc);
 void sys__exit(int exitcode);
 void sys__exit_spc(int exitcode);
 int sys_getpid(pid_t *retval);
@@ -67,6 +72,13 @@ int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 
 int sys_fork(struct trapframe *trap, pid_t *retval);
 int sys_execv(char *program, char **args);
+#if !OPT_DUMBVM
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, vaddr_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_vmstat(pid_t pid, userptr_t vs);
+#endif
 
 #endif // UW
 
@@ -48,6 +48,14 @@ int traffic_simulation(int, char **);
  * Test code.
  */
 
+/* timing for the rate tests */
+struct testtimer {
+	time_t tt_secs;
+	uint32_t tt_nsecs;
+};
+void testtimer_start(struct testtimer *tt);
+void testtimer_report(struct testtimer *tt, const char *what, unsigned count);
+
 /* lib tests */
 int arraytest(int, char **);
 int bitmaptest(int, char **);
@@ -57,6 +65,7 @@ int queuetest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
@@ -79,6 +88,7 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int kmemtest(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
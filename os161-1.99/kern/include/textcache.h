@@ -0,0 +1,43 @@
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*
+ * Shared page cache for program text.
+ *
+ * A read-only page of an executable is the same in every address
+ * space running it, so the first fault keeps the frame here and later
+ * faults, in any process, map the same frame instead of reading the
+ * page again. A page is identified by its vnode, the file offset its
+ * file-backed part starts at, and where in the page and how long that
+ * part is (the rest of the page is zero).
+ *
+ * The cache holds one coremap reference to each frame and one vnode
+ * reference per page; each mapping holds another frame reference, so
+ * pages in use are never paged out. All of these must be called with
+ * vm_lock held.
+ *
+ *    textcache_bootstrap - set up the hash table.
+ *
+ *    textcache_lookup - return the frame holding LEN bytes of V from
+ *                  OFFSET at byte SKIP of the page, with a reference
+ *                  added for the caller, or 0 if it is not cached.
+ *
+ *    textcache_insert - remember the just-filled frame PADDR as that
+ *                  page. The cache takes its own reference. Does
+ *                  nothing if out of memory.
+ *
+ *    textcache_reclaim - free one cached page that nothing maps any
+ *                  more. Returns false if there is none.
+ */
+
+struct vnode;
+
+void textcache_bootstrap(void);
+paddr_t textcache_lookup(struct vnode *v, off_t offset, size_t skip,
+			 size_t len);
+void textcache_insert(struct vnode *v, off_t offset, size_t skip,
+		      size_t len, paddr_t paddr);
+bool textcache_reclaim(void);
+
+
+#endif /* _TEXTCACHE_H_ */
@@ -64,6 +64,9 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/* Names shorter than this are kept in the thread itself */
+#define THREAD_NAMELEN 16
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -83,6 +86,7 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	char t_namebuf[THREAD_NAMELEN];	/* t_name, if it fits */
 
 	/*
 	 * Interrupt state fields.
@@ -157,6 +161,13 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Is another thread waiting to run on this CPU? Only a hint, as the
+ * answer can change at any time; for background work that should keep
+ * out of the way.
+ */
+bool thread_cpu_busy(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -12,7 +12,8 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions (except vmstats_print) whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines) by acquiring stats_lock,
+ * or for _vmstats_inc by having interrupts off.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally (except vmstats_print).
  *
@@ -36,7 +37,15 @@
 #define VMSTAT_ELF_FILE_READ          (7)
 #define VMSTAT_SWAP_FILE_READ         (8)
 #define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#define VMSTAT_AS_SWITCH             (10)
+#define VMSTAT_PAGE_FAULT_SHARED     (11)
+#define VMSTAT_TEXT_CACHED           (12)
+#define VMSTAT_TLB_FAULTAROUND       (13)
+#define VMSTAT_TLB_FAULTAROUND_MISS  (14)
+#define VMSTAT_ZEROPOOL_HIT          (15)
+#define VMSTAT_ZEROPOOL_MISS         (16)
+#define VMSTAT_MMAP_FILE_READ        (17)
+#define VMSTAT_COUNT                 (18)
 
 /* ----------------------------------------------------------------------- */
 
@@ -50,7 +59,10 @@ void _vmstats_init(void);                    /* atomicity must be ensured elsewh
  *   vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
  */
 void vmstats_inc(unsigned int index);    /* uses locking */
-void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
+void _vmstats_inc(unsigned int index);   /* interrupts must be off */
+
+/* Copy out the counts summed over all CPUs */
+void vmstats_get(unsigned int counts[VMSTAT_COUNT]);  /* Does NOT use locking */
 
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print(void);                    /* Does NOT use locking */
@@ -0,0 +1,27 @@
+#ifndef _ZEROPOOL_H_
+#define _ZEROPOOL_H_
+
+/*
+ * Pool of free frames that are already zeroed.
+ *
+ * A kernel thread fills frames in the background, but only while
+ * nothing else wants its CPU and there is plenty of free memory. Zero
+ * fill faults and new page tables take frames from here first and so
+ * skip the bzero.
+ *
+ *    zeropool_bootstrap - start the thread.
+ *
+ *    zeropool_get - take a zeroed frame out of the pool, or return 0
+ *                  if it is empty. Counts a pool hit or miss in
+ *                  vmstats.
+ *
+ *    zeropool_reclaim - hand one pooled frame back to the coremap when
+ *                  memory is short. Returns false if the pool is empty.
+ */
+
+void    zeropool_bootstrap(void);
+paddr_t zeropool_get(void);
+bool    zeropool_reclaim(void);
+
+
+#endif /* _ZEROPOOL_H_ */
@@ -43,16 +43,18 @@
  */
 
 #include <types.h>
+#include <limits.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <kmem_cache.h>
+#include <kern/errno.h>
 #include <kern/fcntl.h>  
 #include <array.h>
-
-void givepid(struct proc *proc);
+#include <file.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -73,33 +75,211 @@ struct semaphore *no_proc_sem;
 #endif  // UW
 
 
-void givepid(struct proc *proc) {
-	unsigned int count = 0;	
-	int min_id = 2; // Assume the min ID is 2
-	if (allprocesses == NULL) {
-		allprocesses = array_create();
-		array_init(allprocesses);
+/*
+ * The process table: one slot per live process. A pid names a slot
+ * and the slot's generation,
+ *
+ *    pid = PID_MIN + generation * PID_NSLOTS + slot
+ *
+ * and freeing a slot moves it to the next generation, so a pid only
+ * comes back once its slot has gone round all PID_NGENS generations.
+ * Free slots are handed out oldest first, to stretch that further.
+ *
+ * Each slot has its own spinlock, so looking up one pid (waitpid)
+ * does not contend with other processes coming and going; the free
+ * list has another. pidlock is only taken by proc_destroy and by
+ * whoever needs a process found with proc_next to stay put.
+ */
+#define PID_NSLOTS 256		/* most processes at once; a power of two */
+#define PID_NGENS  ((PID_MAX - PID_MIN + 1) / PID_NSLOTS)
+#define PID_SLOT(pid) (((pid) - PID_MIN) & (PID_NSLOTS - 1))
+
+struct pidslot {
+	struct spinlock ps_lock;
+	struct proc *ps_proc;		/* NULL if free */
+	unsigned ps_gen;
+};
+
+static struct pidslot pidtable[PID_NSLOTS];
+static unsigned pidfree[PID_NSLOTS];	/* ring of free slots */
+static unsigned pidfree_head, pidfree_count;
+static struct spinlock pidfree_lock = SPINLOCK_INITIALIZER;
+
+struct lock *pidlock;
+
+static
+void
+pid_bootstrap(void)
+{
+	unsigned i;
+
+	for (i = 0; i < PID_NSLOTS; i++) {
+		spinlock_init(&pidtable[i].ps_lock);
+		pidtable[i].ps_proc = NULL;
+		pidtable[i].ps_gen = 0;
+		pidfree[i] = i;
 	}
+	pidfree_head = 0;
+	pidfree_count = PID_NSLOTS;
 
-	if (array_num(allprocesses) != 0) {
-		void * curr_array_entry;
-		while (count < array_num(allprocesses)) {
-				
-			curr_array_entry = array_get(allprocesses,count);
-			count ++;	
-		} // Looks to find an empty array entry previously added it can set
+	pidlock = lock_create("pidlock");
+	if (pidlock == NULL) {
+		panic("could not create pidlock\n");
 	}
-	
-	if (count < array_num(allprocesses)) { // If it finds an array entry to set, it sets it
-		array_set(allprocesses,count,proc);
-		proc->myid = count + min_id;		
+}
+
+/*
+ * Give PROC a pid. Fails with ENPROC if the table is full.
+ */
+static
+int
+pid_alloc(struct proc *proc)
+{
+	struct pidslot *ps;
+	unsigned slot;
+
+	spinlock_acquire(&pidfree_lock);
+	if (pidfree_count == 0) {
+		spinlock_release(&pidfree_lock);
+		return ENPROC;
 	}
-	else {
-		array_add(allprocesses, proc, NULL); // If it finds the whole array full, it adds this new process
-		proc->myid = (array_num(allprocesses) - 1) + min_id ;				
+	slot = pidfree[pidfree_head];
+	pidfree_head = (pidfree_head + 1) % PID_NSLOTS;
+	pidfree_count--;
+	spinlock_release(&pidfree_lock);
+
+	ps = &pidtable[slot];
+	spinlock_acquire(&ps->ps_lock);
+	KASSERT(ps->ps_proc == NULL);
+	ps->ps_proc = proc;
+	proc->myid = PID_MIN + ps->ps_gen * PID_NSLOTS + slot;
+	spinlock_release(&ps->ps_lock);
+	return 0;
+}
+
+static
+void
+pid_free(struct proc *proc)
+{
+	struct pidslot *ps;
+	unsigned slot;
+
+	slot = PID_SLOT(proc->myid);
+	ps = &pidtable[slot];
+	spinlock_acquire(&ps->ps_lock);
+	KASSERT(ps->ps_proc == proc);
+	ps->ps_proc = NULL;
+	ps->ps_gen = (ps->ps_gen + 1) % PID_NGENS;
+	spinlock_release(&ps->ps_lock);
+
+	spinlock_acquire(&pidfree_lock);
+	KASSERT(pidfree_count < PID_NSLOTS);
+	pidfree[(pidfree_head + pidfree_count) % PID_NSLOTS] = slot;
+	pidfree_count++;
+	spinlock_release(&pidfree_lock);
+}
+
+int
+proc_getchild(struct proc *parent, pid_t pid, struct proc **ret)
+{
+	struct pidslot *ps;
+	struct proc *p;
+	int result = 0;
+
+	if (pid < PID_MIN || pid > PID_MAX) {
+		return ESRCH;
+	}
+
+	ps = &pidtable[PID_SLOT(pid)];
+	spinlock_acquire(&ps->ps_lock);
+	p = ps->ps_proc;
+	if (p == NULL || p->myid != pid) {
+		result = ESRCH;
+	}
+	else if (p->p_parent != parent) {
+		result = ECHILD;
+	}
+	spinlock_release(&ps->ps_lock);
+
+	/* Our child cannot go away until we let go of its exitinglock */
+	*ret = result ? NULL : p;
+	return result;
+}
+
+struct proc *
+proc_next(pid_t pid)
+{
+	struct proc *p, *best = NULL;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(pidlock));
+
+	for (i = 0; i < PID_NSLOTS; i++) {
+		spinlock_acquire(&pidtable[i].ps_lock);
+		p = pidtable[i].ps_proc;
+		if (p != NULL && p->myid >= pid &&
+		    (best == NULL || p->myid < best->myid)) {
+			best = p;
+		}
+		spinlock_release(&pidtable[i].ps_lock);
+	}
+	return best;
+}
+
+
+/*
+ * Proc structures are kept in a cache with the parts that outlive any
+ * one process already made: the thread array, the kids array and the
+ * locks and cv used by exit and waitpid.
+ */
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->mykids = array_create();
+	proc->exitinglock = lock_create("exitinglock");
+	proc->waitinglock = lock_create("waitinglock");
+	proc->mycv = cv_create("mycv");
+	if (proc->mykids == NULL || proc->exitinglock == NULL ||
+	    proc->waitinglock == NULL || proc->mycv == NULL) {
+		if (proc->mykids != NULL) {
+			array_destroy(proc->mykids);
+		}
+		if (proc->exitinglock != NULL) {
+			lock_destroy(proc->exitinglock);
+		}
+		if (proc->waitinglock != NULL) {
+			lock_destroy(proc->waitinglock);
+		}
+		if (proc->mycv != NULL) {
+			cv_destroy(proc->mycv);
+		}
+		return ENOMEM;
 	}
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	array_destroy(proc->mykids);
+	lock_destroy(proc->waitinglock);
+	lock_destroy(proc->exitinglock);
+	cv_destroy(proc->mycv);
 }
 
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc),
+			       proc_ctor, proc_dtor);
 
 /*
  * Create a proc structure.
@@ -109,28 +289,33 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+	int i;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
 
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
+	proc->myid = 0;
+	proc->p_parent = NULL;
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	bzero(proc->p_vmstats, sizeof(proc->p_vmstats));
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
 #ifdef UW
 	proc->console = NULL;
+	for (i = 0; i < OPEN_MAX; i++) {
+		proc->p_files[i] = NULL;
+	}
 #endif // UW
 
 	return proc;
@@ -191,25 +376,22 @@ proc_destroy(struct proc *proc)
 	if (proc->console) {
 	  vfs_close(proc->console);
 	}
+	filetable_destroy(proc);
 #endif // UW
 
-	// Lock needed here?
-	lock_acquire(pidlock);
-	array_set(allprocesses,(proc->myid - 2),NULL);
-		
-	array_destroy(proc->mykids);
-	lock_release(pidlock);	
-
-	lock_destroy(proc->waitinglock);
-	lock_destroy(proc->exitinglock);
-	cv_destroy(proc->mycv);
-
+	/* Give the pid back; vmstat may be looking at us */
+	if (proc->myid != 0) {
+		lock_acquire(pidlock);
+		pid_free(proc);
+		lock_release(pidlock);
+	}
+	array_setsize(proc->mykids, 0);
 
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
+	/* the locks, cv and arrays stay with the cached proc */
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
@@ -252,9 +434,7 @@ proc_bootstrap(void)
   
 #endif // UW 
 
-pidlock = lock_create("pidlock");
-pidlock2 = lock_create("pidlock2");
-
+  pid_bootstrap();
 }
 
 /*
@@ -265,13 +445,29 @@ pidlock2 = lock_create("pidlock2");
  */
 struct proc *
 proc_create_runprogram(const char *name)
+{
+	struct proc *proc;
+
+	if (proc_create_user(name, &proc)) {
+		return NULL;
+	}
+	return proc;
+}
+
+/*
+ * The same, but failing with ENOMEM, or ENPROC if the process table
+ * is full, so that fork can tell which.
+ */
+int
+proc_create_user(const char *name, struct proc **ret)
 {
 	struct proc *proc;
 	char *console_path;
+	int result;
 
 	proc = proc_create(name);
 	if (proc == NULL) {
-		return NULL;
+		return ENOMEM;
 	}
 
 #ifdef UW
@@ -317,24 +513,17 @@ proc_create_runprogram(const char *name)
 	proc_count++;
 	V(proc_count_mutex);
 #endif // UW
-	proc->mykids=array_create();
-	array_init(proc->mykids);
-
 	proc->exitcode=0;
 	proc->exited=false;
 
-	proc->exitinglock=lock_create("exitinglock");
-	proc->waitinglock=lock_create("waitinglock");
-
-	proc->mycv=cv_create("mycv");
-
-	lock_acquire(pidlock);
-	givepid(proc);
-	lock_release(pidlock);
-
-
+	result = pid_alloc(proc);
+	if (result) {
+		proc_destroy(proc);
+		return result;
+	}
 
-	return proc;
+	*ret = proc;
+	return 0;
 }
 
 /*
@@ -49,6 +49,7 @@
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
+#include <uw-vmstats.h>
 #include "autoconf.h"  // for pseudoconfig
 
 
@@ -153,6 +154,8 @@ shutdown(void)
 
 	thread_shutdown();
 
+	vmstats_print();
+
 	splhigh();
 }
 
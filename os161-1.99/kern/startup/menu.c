@@ -42,9 +42,13 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <coremap.h>
+#include <addrspace.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
+#include "opt-khprof.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -261,6 +265,34 @@ cmd_dth(int nargs, char **args)
 	return 0;
 }
 
+#if !OPT_DUMBVM
+/*
+ * Command for setting the fault-around window, in pages.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	unsigned npages;
+
+	if (nargs != 2) {
+		kprintf("Usage: fa npages\n");
+		return EINVAL;
+	}
+
+	npages = atoi(args[1]);
+	if (npages > VM_FAULTAROUND_MAX || (npages & (npages - 1)) != 0) {
+		kprintf("fa: window must be 0 or a power of two up to %d\n",
+			VM_FAULTAROUND_MAX);
+		return EINVAL;
+	}
+
+	vm_faultaround = npages;
+
+	return 0;
+}
+#endif
+
 /*
  * Command for running sync.
  */
@@ -413,6 +445,34 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_khprof(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+#if OPT_KHPROF
+	kheap_printprofile();
+#else
+	kprintf("khprof: kernel not built with options khprof\n");
+#endif
+
+	return 0;
+}
+
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -444,6 +504,9 @@ showmenu(const char *name, const char *x[])
 
 static const char *opsmenu[] = {
 	"[dth]     Enable debugging output   ",
+#if !OPT_DUMBVM
+	"[fa]      Set fault-around window   ",
+#endif
 	"[s]       Shell                     ",
 	"[p]       Other program             ",
 	"[mount]   Mount a filesystem        ",
@@ -474,9 +537,11 @@ static const char *testmenu[] = {
 	"[bt]  Bitmap test                   ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] Object cache test             ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread fork rate test         ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -523,6 +588,8 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[khprof] Kernel heap profile        ",
+	"[cm] Coremap free block stats       ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -555,6 +622,9 @@ static struct {
 
 	/* operations */
 	{ "dth",	cmd_dth },
+#if !OPT_DUMBVM
+	{ "fa",		cmd_faultaround },
+#endif
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
 	{ "mount",	cmd_mount },
@@ -580,18 +650,22 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "khprof",     cmd_khprof },
+	{ "cm",         cmd_coremapstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+	{ "km3",	kmemtest },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
@@ -0,0 +1,130 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <current.h>
+#include <proc.h>
+#include <file.h>
+
+/*
+ * Open file objects and the per-process descriptor table.
+ */
+
+static
+void
+openfile_decref(struct openfile *of)
+{
+	bool last;
+
+	lock_acquire(of->of_lock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount--;
+	last = of->of_refcount == 0;
+	lock_release(of->of_lock);
+
+	if (last) {
+		vfs_close(of->of_vnode);
+		lock_destroy(of->of_lock);
+		kfree(of);
+	}
+}
+
+int
+file_open(char *path, int flags, mode_t mode, int *fd)
+{
+	struct openfile *of;
+	struct proc *p = curproc;
+	int i, result;
+
+	for (i = FD_FIRST; i < OPEN_MAX; i++) {
+		if (p->p_files[i] == NULL) {
+			break;
+		}
+	}
+	if (i == OPEN_MAX) {
+		return EMFILE;
+	}
+
+	of = kmalloc(sizeof(struct openfile));
+	if (of == NULL) {
+		return ENOMEM;
+	}
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		kfree(of);
+		return ENOMEM;
+	}
+
+	result = vfs_open(path, flags, mode, &of->of_vnode);
+	if (result) {
+		lock_destroy(of->of_lock);
+		kfree(of);
+		return result;
+	}
+	of->of_accmode = flags & O_ACCMODE;
+	of->of_offset = 0;
+	of->of_refcount = 1;
+
+	p->p_files[i] = of;
+	*fd = i;
+	return 0;
+}
+
+int
+file_get(int fd, struct openfile **ret)
+{
+	if (fd < FD_FIRST || fd >= OPEN_MAX || curproc->p_files[fd] == NULL) {
+		return EBADF;
+	}
+	*ret = curproc->p_files[fd];
+	return 0;
+}
+
+int
+file_close(int fd)
+{
+	struct openfile *of;
+	int result;
+
+	result = file_get(fd, &of);
+	if (result) {
+		return result;
+	}
+	curproc->p_files[fd] = NULL;
+	openfile_decref(of);
+	return 0;
+}
+
+void
+filetable_copy(struct proc *from, struct proc *to)
+{
+	struct openfile *of;
+	int i;
+
+	for (i = FD_FIRST; i < OPEN_MAX; i++) {
+		of = from->p_files[i];
+		if (of == NULL) {
+			continue;
+		}
+		lock_acquire(of->of_lock);
+		of->of_refcount++;
+		lock_release(of->of_lock);
+		to->p_files[i] = of;
+	}
+}
+
+void
+filetable_destroy(struct proc *proc)
+{
+	int i;
+
+	for (i = FD_FIRST; i < OPEN_MAX; i++) {
+		if (proc->p_files[i] != NULL) {
+			openfile_decref(proc->p_files[i]);
+			proc->p_files[i] = NULL;
+		}
+	}
+}
@@ -1,6 +1,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/unistd.h>
+#include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
 #include <syscall.h>
@@ -8,6 +9,142 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <file.h>
+
+/*
+ * Read or write NBYTES at UBUF from/to open file FDESC, at the file's
+ * current offset, and advance the offset.
+ *
+ * The data goes through a kernel buffer, FILE_BOUNCE bytes at a time,
+ * and is copied in or out with no VOP in progress. The devices hold
+ * their own locks while they move data, and a fault on a user page
+ * that is not in yet may need to read from that same device (the
+ * executable, or an mmapped file) to bring it in.
+ */
+#define FILE_BOUNCE 1024
+
+static
+int
+file_rw(int fdesc, userptr_t ubuf, size_t nbytes, enum uio_rw rw, int *retval)
+{
+  struct openfile *of;
+  struct iovec iov;
+  struct uio u;
+  char *buf;
+  size_t done, len, got;
+  int res;
+
+  res = file_get(fdesc,&of);
+  if (res) {
+    return res;
+  }
+  if ((rw == UIO_READ && of->of_accmode == O_WRONLY) ||
+      (rw == UIO_WRITE && of->of_accmode == O_RDONLY)) {
+    return EBADF;
+  }
+
+  buf = kmalloc(FILE_BOUNCE);
+  if (buf == NULL) {
+    return ENOMEM;
+  }
+
+  /* the offset may be shared with a parent or child */
+  lock_acquire(of->of_lock);
+  done = 0;
+  while (done < nbytes) {
+    len = nbytes - done;
+    if (len > FILE_BOUNCE) {
+      len = FILE_BOUNCE;
+    }
+    if (rw == UIO_WRITE) {
+      res = copyin(ubuf + done, buf, len);
+      if (res) {
+        break;
+      }
+    }
+
+    uio_kinit(&iov, &u, buf, len, of->of_offset, rw);
+    if (rw == UIO_READ) {
+      res = VOP_READ(of->of_vnode,&u);
+    }
+    else {
+      res = VOP_WRITE(of->of_vnode,&u);
+    }
+    if (res) {
+      break;
+    }
+    got = len - u.uio_resid;
+
+    if (rw == UIO_READ) {
+      res = copyout(buf, ubuf + done, got);
+      if (res) {
+        break;
+      }
+    }
+    of->of_offset = u.uio_offset;
+    done += got;
+    if (got < len) {
+      /* end of file, or the device took less */
+      break;
+    }
+  }
+  lock_release(of->of_lock);
+  kfree(buf);
+
+  /* report what got through, if anything did, like a short read */
+  if (res && done == 0) {
+    return res;
+  }
+  *retval = done;
+  return 0;
+}
+
+/* handler for open() system call                   */
+int
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
+{
+  char *path;
+  int res;
+
+  DEBUG(DB_SYSCALL,"Syscall: open(%x,%x)\n",(unsigned int)upath,flags);
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  res = copyinstr(upath,path,PATH_MAX,NULL);
+  if (res == 0) {
+    res = file_open(path,flags,mode,retval);
+  }
+  kfree(path);
+  return res;
+}
+
+/* handler for read() system call                   */
+/*
+ * Only files from open() can be read; there is no console input.
+ */
+int
+sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+
+  if (fdesc >= 0 && fdesc < FD_FIRST) {
+    return EUNIMP;
+  }
+  return file_rw(fdesc,ubuf,nbytes,UIO_READ,retval);
+}
+
+/* handler for close() system call                  */
+int
+sys_close(int fdesc)
+{
+  DEBUG(DB_SYSCALL,"Syscall: close(%d)\n",fdesc);
+
+  return file_close(fdesc);
+}
 
 /* handler for write() system call                  */
 /*
@@ -28,8 +165,13 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   int res;
 
   DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+
+  /* files from open() */
+  if (fdesc >= FD_FIRST) {
+    return file_rw(fdesc,ubuf,nbytes,UIO_WRITE,retval);
+  }
   
-  /* only stdout and stderr writes are currently implemented */
+  /* otherwise only stdout and stderr writes are currently implemented */
   if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
     return EUNIMP;
   }
@@ -59,6 +59,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include "opt-dumbvm.h"
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -73,6 +74,11 @@
  * executable whose load address is in kernel space. If you should
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
+ *
+ * With the paged VM nothing is read here: the segment is only
+ * recorded in the address space, and vm_fault reads each page from
+ * the file the first time it is touched. as_define_region has already
+ * refused any segment outside user space.
  */
 static
 int
@@ -81,8 +87,10 @@ load_segment(struct addrspace *as, struct vnode *v,
 	     size_t memsize, size_t filesize,
 	     int is_executable)
 {
+#if OPT_DUMBVM
 	struct iovec iov;
 	struct uio u;
+#endif
 	int result;
 
 	if (filesize > memsize) {
@@ -90,6 +98,15 @@ load_segment(struct addrspace *as, struct vnode *v,
 		filesize = memsize;
 	}
 
+#if !OPT_DUMBVM
+	(void)is_executable;
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	result = as_define_file(as, v, vaddr, offset, filesize);
+	return result;
+#else
+
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
 	      (unsigned long) filesize, (unsigned long) vaddr);
 
@@ -143,6 +160,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 #endif
 	
 	return result;
+#endif /* OPT_DUMBVM */
 }
 
 /*
@@ -12,20 +12,13 @@
 #include <mips/trapframe.h>
 #include <kern/fcntl.h>
 #include <vfs.h>
+#include <file.h>
 
   /* this implementation of sys__exit does not do anything with the exit code */
   /* this needs to be fixed to get exit() and waitpid() working properly */
 
-int min_id = 2; 
 void kill_kids (struct array * processes, int num_processes );
-struct proc * gen_pid (pid_t pid);
 
-
-struct proc * gen_pid (pid_t pid) {
-  int array_location = pid - min_id;
-  return array_get(allprocesses,array_location);
-}
-  
 void kill_kids (struct array * processes, int num_processes ) {
   int count = 0;
   while (count < num_processes) {
@@ -34,6 +27,7 @@ void kill_kids (struct array * processes, int num_processes ) {
        //DO NOTHING
      }
      else {
+       current->p_parent = NULL;
        lock_release(current->exitinglock);
      }
      array_remove(processes, 0);
@@ -54,8 +48,11 @@ void sys__exit(int exitcode) {
 
   // -------------------------------------------------------------
 
+  lock_acquire(p->waitinglock);
   p->exitcode = _MKWAIT_EXIT(exitcode);
   p->exited = true;
+  cv_broadcast(p->mycv, p->waitinglock);
+  lock_release(p->waitinglock);
 
   // Telling its kids they can die >:D
 
@@ -64,8 +61,6 @@ void sys__exit(int exitcode) {
 
   kill_kids (cur_array, num_kids);
 
-  cv_broadcast(p->mycv, p->waitinglock);
-    
   lock_acquire(p->exitinglock);
   lock_release(p->exitinglock);
   // ---------------------------------------------------------------
@@ -129,9 +124,13 @@ sys_waitpid(pid_t pid,
 
   // -----------------------------------------
 
-  lock_acquire(pidlock);
-  struct proc *current = gen_pid(pid);
-  lock_release(pidlock);
+  struct proc *current;
+  unsigned i;
+
+  result = proc_getchild(curproc, pid, &current);
+  if (result) {
+    return result;
+  }
 
   lock_acquire(current->waitinglock);
   while(current->exited == false){
@@ -139,10 +138,20 @@ sys_waitpid(pid_t pid,
   }
   lock_release(current->waitinglock);
 
-  // ----------------------------------------
-
-  /* for now, just pretend the exitstatus is 0 */
   exitstatus=current->exitcode;
+
+  // Collected: let it finish dying, which frees its pid for reuse
+
+  for (i = 0; i < array_num(curproc->mykids); i++) {
+    if (array_get(curproc->mykids, i) == current) {
+      array_remove(curproc->mykids, i);
+      break;
+    }
+  }
+  current->p_parent = NULL;
+  lock_release(current->exitinglock);
+
+  // ----------------------------------------
   
   result = copyout((void *)&exitstatus,status,sizeof(int));
   if (result) {
@@ -152,22 +161,67 @@ sys_waitpid(pid_t pid,
   return(0);
 }
 
-int sys_fork(struct trapframe *trap, pid_t *retval) {
-   struct proc *myclone = proc_create_runprogram(curproc->p_name);
-
-   as_copy(curproc_getas(),&(myclone->p_addrspace));
-
-   struct trapframe *myclone_tf=kmalloc(sizeof(struct trapframe));
+/*
+ * Undo a fork that got as far as creating MYCLONE but will not run it.
+ */
+static void fork_fail(struct proc *myclone) {
+   struct addrspace *as = myclone->p_addrspace;
+
+   myclone->p_addrspace = NULL;
+   if (as != NULL) {
+     as_destroy(as);
+   }
+   proc_destroy(myclone);
+}
 
+int sys_fork(struct trapframe *trap, pid_t *retval) {
+   struct proc *myclone;
+   struct trapframe *myclone_tf;
+   unsigned index;
+   int result;
+
+   result = proc_create_user(curproc->p_name, &myclone);
+   if (result) {
+     return result;
+   }
+
+   result = as_copy(curproc_getas(),&(myclone->p_addrspace));
+   if (result) {
+     fork_fail(myclone);
+     return result;
+   }
+   filetable_copy(curproc, myclone);
+
+   myclone_tf=kmalloc(sizeof(struct trapframe));
+   if (myclone_tf == NULL) {
+     fork_fail(myclone);
+     return ENOMEM;
+   }
    memcpy(myclone_tf,trap,sizeof(struct trapframe));
 
-   thread_fork(curthread->t_name, myclone, (void*)enter_forked_process, myclone_tf, 0);
-
-   array_add(curproc->mykids,myclone,NULL);   
+   myclone->p_parent = curproc;
+   result = array_add(curproc->mykids,myclone,&index);
+   if (result) {
+     kfree(myclone_tf);
+     fork_fail(myclone);
+     return result;
+   }
    
    // Abuse your child by even taking away its ability to truly die :)
+   // (before it can run, or it might exit without waiting for us)
 
    lock_acquire(myclone->exitinglock);
+
+   result = thread_fork(curthread->t_name, myclone, (void*)enter_forked_process, myclone_tf, 0);
+   if (result) {
+     // it never ran, so nothing else has touched mykids
+     array_remove(curproc->mykids, index);
+     lock_release(myclone->exitinglock);
+     kfree(myclone_tf);
+     fork_fail(myclone);
+     return result;
+   }
+
    *retval = myclone->myid;
     return 0;
 }
@@ -270,8 +324,11 @@ void sys__exit_spc(int exitcode) {
 
   // -------------------------------------------------------------
 
+  lock_acquire(p->waitinglock);
   p->exitcode = _MKWAIT_SIG(exitcode);
   p->exited = true;
+  cv_broadcast(p->mycv, p->waitinglock);
+  lock_release(p->waitinglock);
 
   // Telling its kids they can die >:D
 
@@ -280,8 +337,6 @@ void sys__exit_spc(int exitcode) {
 
   kill_kids (cur_array, num_kids);
 
-  cv_broadcast(p->mycv, p->waitinglock);
-    
   lock_acquire(p->exitinglock);
   lock_release(p->exitinglock);
   // ---------------------------------------------------------------
@@ -0,0 +1,207 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/vmstat.h>
+#include <stat.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+#include <vnode.h>
+#include <file.h>
+
+/* handler for sbrk() system call                   */
+/*
+ * Moves the end of the heap by AMOUNT bytes and returns the old end.
+ * A negative AMOUNT gives memory back. The pages themselves are only
+ * filled in when the program touches them (see vm_fault).
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_sbrk(as, amount, retval);
+}
+
+/* handler for mmap() system call                   */
+/*
+ * Maps LEN bytes of open file FD from OFFSET (a multiple of the page
+ * size) and returns the address. ADDR is only a hint and is ignored.
+ * MAP_PRIVATE mappings may be written whatever the file was opened
+ * for; MAP_SHARED writable ones need the file open for writing.
+ *
+ * n.b. after fork, pages of a MAP_SHARED mapping that are resident
+ * stay one frame, writable by both parent and child, so each sees the
+ * other's writes at once. Pages that are not resident yet are read
+ * from the file separately by each side, and only see the other's
+ * writes once those reach the file.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, vaddr_t *retval)
+{
+	struct addrspace *as;
+	struct openfile *of;
+	struct stat st;
+	int result;
+
+	(void)addr;
+
+	if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+		return EINVAL;
+	}
+	if (offset < 0 || (offset & (PAGE_SIZE - 1)) != 0) {
+		return EINVAL;
+	}
+
+	result = file_get(fd, &of);
+	if (result) {
+		return result;
+	}
+	if (of->of_accmode == O_WRONLY) {
+		return EACCES;
+	}
+	if (flags == MAP_SHARED && (prot & PROT_WRITE) &&
+	    of->of_accmode != O_RDWR) {
+		return EACCES;
+	}
+
+	result = VOP_MMAP(of->of_vnode);
+	if (result) {
+		return result == EUNIMP ? ENODEV : result;
+	}
+	result = VOP_STAT(of->of_vnode, &st);
+	if (result) {
+		return result;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	return as_mmap(as, of->of_vnode, len, prot, flags, offset,
+		       st.st_size, retval);
+}
+
+/* handler for munmap() system call                 */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return as_munmap(as, (vaddr_t)addr, len);
+}
+
+/*
+ * Fill in the event counts of VS from the vmstats-style COUNTS.
+ */
+static
+void
+vmstat_fill(struct vmstat *vs, const unsigned *counts)
+{
+	vs->vs_tlbfaults = counts[VMSTAT_TLB_FAULT];
+	vs->vs_tlbreloads = counts[VMSTAT_TLB_RELOAD];
+	vs->vs_zerofaults = counts[VMSTAT_PAGE_FAULT_ZERO];
+	vs->vs_filefaults = counts[VMSTAT_ELF_FILE_READ] +
+		counts[VMSTAT_MMAP_FILE_READ];
+	vs->vs_swapins = counts[VMSTAT_SWAP_FILE_READ];
+	vs->vs_sharedfaults = counts[VMSTAT_PAGE_FAULT_SHARED];
+	vs->vs_swapouts = counts[VMSTAT_SWAP_FILE_WRITE];
+}
+
+/*
+ * Look up the process with the lowest pid that is at least PID and
+ * fill in VS for it. Returns ESRCH if there is none.
+ */
+static
+int
+vmstat_proc(pid_t pid, struct vmstat *vs)
+{
+	struct proc *p;
+	struct addrspace *as;
+	unsigned i;
+
+	/* pidlock keeps the proc from being destroyed under us */
+	lock_acquire(pidlock);
+	p = proc_next(pid);
+	if (p == NULL) {
+		lock_release(pidlock);
+		return ESRCH;
+	}
+
+	vs->vs_pid = p->myid;
+	for (i = 0; i < VMSTAT_NAMELEN - 1 && p->p_name[i] != 0; i++) {
+		vs->vs_name[i] = p->p_name[i];
+	}
+	vs->vs_name[i] = 0;
+	vmstat_fill(vs, p->p_vmstats);
+
+	/*
+	 * An address space is taken out of the proc before it is
+	 * destroyed, and destroying it needs vm_lock, so one we find
+	 * here stays valid while we hold vm_lock.
+	 */
+	vs->vs_resident = 0;
+	vs->vs_swapped = 0;
+	lock_acquire(vm_lock);
+	spinlock_acquire(&p->p_lock);
+	as = p->p_addrspace;
+	spinlock_release(&p->p_lock);
+	if (as != NULL) {
+		as_countpages(as, &vs->vs_resident, &vs->vs_swapped);
+	}
+	lock_release(vm_lock);
+	lock_release(pidlock);
+	return 0;
+}
+
+/* handler for vmstat() system call                 */
+/*
+ * Copies out VM statistics for the process with the lowest pid that
+ * is at least PID, so that a caller can walk all processes by asking
+ * for one more than the pid it got last. PID 0 gives totals for the
+ * whole system, where resident pages include the kernel's.
+ */
+int
+sys_vmstat(pid_t pid, userptr_t vsp)
+{
+	struct vmstat vs;
+	unsigned counts[VMSTAT_COUNT];
+	int result;
+
+	bzero(&vs, sizeof(vs));
+	if (pid < 0) {
+		return EINVAL;
+	}
+	else if (pid == 0) {
+		vs.vs_pid = 0;
+		strcpy(vs.vs_name, "[system]");
+		vmstats_get(counts);
+		vmstat_fill(&vs, counts);
+		vs.vs_resident = coremap_nframes() - coremap_nfree();
+		vs.vs_swapped = swap_used();
+	}
+	else {
+		result = vmstat_proc(pid, &vs);
+		if (result) {
+			return result;
+		}
+	}
+	return copyout(&vs, vsp, sizeof(vs));
+}
@@ -0,0 +1,102 @@
+/*
+ * Test code for the object caches.
+ */
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <wchan.h>
+#include <test.h>
+
+/*
+ * Create and destroy NLOOPS locks, cvs and threads, and print how many
+ * of each per second. For locks the same is done first the way
+ * lock_create used to, straight from kmalloc, to show what the cache
+ * saves.
+ */
+
+#define NLOOPS 2000
+
+static struct semaphore *kmemsem;
+
+static struct testtimer kmemtimer;
+
+static
+void
+kmemthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+	V(kmemsem);
+}
+
+int
+kmemtest(int nargs, char **args)
+{
+	struct lock *lk;
+	struct cv *cv;
+	struct wchan *wc;
+	char *name;
+	void *ptr;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	kmemsem = sem_create("kmemsem", 0);
+	if (kmemsem == NULL) {
+		panic("kmemtest: sem_create failed\n");
+	}
+
+	kprintf("Starting object cache test...\n");
+
+	testtimer_start(&kmemtimer);
+	for (i=0; i<NLOOPS; i++) {
+		ptr = kmalloc(sizeof(struct lock));
+		name = kstrdup("kmemtest");
+		wc = wchan_create(name);
+		if (ptr == NULL || name == NULL || wc == NULL) {
+			panic("kmemtest: out of memory\n");
+		}
+		wchan_destroy(wc);
+		kfree(name);
+		kfree(ptr);
+	}
+	testtimer_report(&kmemtimer, "lock-sized kmalloc+wchan:", NLOOPS);
+
+	testtimer_start(&kmemtimer);
+	for (i=0; i<NLOOPS; i++) {
+		lk = lock_create("kmemtest");
+		if (lk == NULL) {
+			panic("kmemtest: lock_create failed\n");
+		}
+		lock_destroy(lk);
+	}
+	testtimer_report(&kmemtimer, "lock_create/lock_destroy:", NLOOPS);
+
+	testtimer_start(&kmemtimer);
+	for (i=0; i<NLOOPS; i++) {
+		cv = cv_create("kmemtest");
+		if (cv == NULL) {
+			panic("kmemtest: cv_create failed\n");
+		}
+		cv_destroy(cv);
+	}
+	testtimer_report(&kmemtimer, "cv_create/cv_destroy:", NLOOPS);
+
+	testtimer_start(&kmemtimer);
+	for (i=0; i<NLOOPS; i++) {
+		result = thread_fork("kmemtest", NULL, kmemthread, NULL, i);
+		if (result) {
+			panic("kmemtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		P(kmemsem);
+	}
+	testtimer_report(&kmemtimer, "thread_fork/thread_exit:", NLOOPS);
+
+	sem_destroy(kmemsem);
+	kprintf("Object cache test done\n");
+
+	return 0;
+}
@@ -34,6 +34,8 @@
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <cpu.h>
+#include <current.h>
 #include <test.h>
 
 /*
@@ -45,11 +47,18 @@
  *
  * mallocstress does the same thing, but from NTHREADS different
  * threads at once.
+ *
+ * Both then report how many kmalloc/kfree pairs per second they
+ * manage; mallocstress does so for 1, 2 and 4 threads. These all
+ * start on the current CPU and only reach the others if
+ * thread_consider_migration moves them, so the figures are per
+ * thread count, not per CPU count.
  */
 
 #define NTRIES   1200
 #define ITEMSIZE  997
 #define NTHREADS  8
+#define RATE_ROUNDS 20
 
 static
 void
@@ -90,6 +99,55 @@ mallocthread(void *sm, unsigned long num)
 	}
 }
 
+static
+void
+ratethread(void *sm, unsigned long num)
+{
+	int i;
+
+	(void)num;
+	for (i=0; i<RATE_ROUNDS; i++) {
+		mallocthread(NULL, 0);
+	}
+	if (sm) {
+		V((struct semaphore *)sm);
+	}
+}
+
+/*
+ * Run ratethread in NTHR threads at once (in this one if SEM is NULL)
+ * and print the kmalloc rate they achieve between them.
+ */
+static
+void
+mallocrate(unsigned nthr, struct semaphore *sem)
+{
+	struct testtimer tt;
+	char what[32];
+	unsigned i;
+	int result;
+
+	testtimer_start(&tt);
+	if (sem == NULL) {
+		ratethread(NULL, 0);
+	}
+	else {
+		for (i=0; i<nthr; i++) {
+			result = thread_fork("mallocrate", NULL,
+					     ratethread, sem, i);
+			if (result) {
+				panic("mallocrate: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<nthr; i++) {
+			P(sem);
+		}
+	}
+	snprintf(what, sizeof(what), "kmalloc, %u thread(s):", nthr);
+	testtimer_report(&tt, what, nthr * RATE_ROUNDS * NTRIES);
+}
+
 int
 malloctest(int nargs, char **args)
 {
@@ -98,6 +156,7 @@ malloctest(int nargs, char **args)
 
 	kprintf("Starting kmalloc test...\n");
 	mallocthread(NULL, 0);
+	mallocrate(1, NULL);
 	kprintf("kmalloc test done\n");
 
 	return 0;
@@ -132,6 +191,12 @@ mallocstress(int nargs, char **args)
 		P(sem);
 	}
 
+	kprintf("Rate threads start on cpu%u; migration may spread them\n",
+		curcpu->c_number);
+	for (i=1; i<=4; i*=2) {
+		mallocrate(i, sem);
+	}
+
 	sem_destroy(sem);
 	kprintf("kmalloc stress test done\n");
 
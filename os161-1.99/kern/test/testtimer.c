@@ -0,0 +1,40 @@
+/*
+ * Timing for the rate tests.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <test.h>
+
+void
+testtimer_start(struct testtimer *tt)
+{
+	gettime(&tt->tt_secs, &tt->tt_nsecs);
+}
+
+/*
+ * Print how long COUNT operations took since testtimer_start, and how
+ * many that is per second. 32 bits of microseconds is over an hour,
+ * plenty for these tests; the rate drops to millisecond resolution
+ * only when COUNT is too big to scale by a million.
+ */
+void
+testtimer_report(struct testtimer *tt, const char *what, unsigned count)
+{
+	time_t secs2, secs;
+	uint32_t nsecs2, nsecs;
+	unsigned us, rate;
+
+	gettime(&secs2, &nsecs2);
+	getinterval(tt->tt_secs, tt->tt_nsecs, secs2, nsecs2, &secs, &nsecs);
+	us = secs * 1000000 + nsecs / 1000;
+
+	if (count <= 0xffffffffU / 1000000) {
+		rate = us > 0 ? count * 1000000 / us : 0;
+	}
+	else {
+		KASSERT(count <= 0xffffffffU / 1000);
+		rate = us >= 1000 ? count * 1000 / (us / 1000) : 0;
+	}
+	kprintf("%-28s %u in %u us, %u per second\n", what, count, us, rate);
+}
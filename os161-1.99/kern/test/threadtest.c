@@ -37,6 +37,7 @@
 #include <test.h>
 
 #define NTHREADS  8
+#define NFORKS    2000
 
 static struct semaphore *tsem = NULL;
 
@@ -144,3 +145,61 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Thread create/join rate: fork NFORKS threads that do nothing, first
+ * waiting for each before forking the next and then NTHREADS at a
+ * time, and print how many per second.
+ */
+
+static
+void
+forkthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(tsem);
+}
+
+static
+void
+forkthreads(unsigned batch)
+{
+	struct testtimer tt;
+	char what[32];
+	unsigned i, j;
+	int result;
+
+	testtimer_start(&tt);
+	for (i=0; i<NFORKS; i+=batch) {
+		for (j=0; j<batch; j++) {
+			result = thread_fork("threadtest4", NULL,
+					     forkthread, NULL, j);
+			if (result) {
+				panic("threadtest4: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (j=0; j<batch; j++) {
+			P(tsem);
+		}
+	}
+	snprintf(what, sizeof(what), "threads, %u at a time:", batch);
+	testtimer_report(&tt, what, NFORKS);
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting thread fork test...\n");
+	forkthreads(1);
+	forkthreads(NTHREADS);
+	kprintf("Thread fork test done.\n");
+
+	return 0;
+}
@@ -218,7 +218,7 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
-          /* VMSTAT_PAGE_FAULT_DISK = VMSTAT_ELF_FILE_READ + VMSTAT_SWAP_FILE_READ */
+          /* VMSTAT_PAGE_FAULT_DISK = VMSTAT_ELF_FILE_READ + VMSTAT_MMAP_FILE_READ + VMSTAT_SWAP_FILE_READ */
           case VMSTAT_PAGE_FAULT_DISK:
             if (i % 2 == 0) {
                vmstats_inc(j);
@@ -226,7 +226,7 @@ vmstats_thread(void *junk, unsigned long num)
             break;
 
           case VMSTAT_ELF_FILE_READ:
-            if (i % 4 == 0) {
+            if (i % 8 == 0) {
                vmstats_inc(j);
             }
             break;
@@ -243,6 +243,48 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
+          case VMSTAT_AS_SWITCH:
+            vmstats_inc(j);
+            break;
+
+          /* Left out so the TLB fault sum above still adds up */
+          case VMSTAT_PAGE_FAULT_SHARED:
+            break;
+
+          case VMSTAT_TEXT_CACHED:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_TLB_FAULTAROUND:
+            if (i % 2 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_TLB_FAULTAROUND_MISS:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_ZEROPOOL_HIT:
+            vmstats_inc(j);
+            break;
+
+          case VMSTAT_ZEROPOOL_MISS:
+            if (i % 4 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
+          case VMSTAT_MMAP_FILE_READ:
+            if (i % 8 == 0) {
+               vmstats_inc(j);
+            }
+            break;
+
           default:
             kprintf("Unknown stat %d\n", j);
             break;
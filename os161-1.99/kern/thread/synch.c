@@ -33,13 +33,39 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <kmem_cache.h>
 #include <synch.h>
 
+/*
+ * Copy NAME into BUF if it fits, or else into a fresh string. Returns
+ * the copy, or NULL if out of memory.
+ */
+static
+char *
+synch_setname(char *buf, const char *name)
+{
+        if (strlen(name) < SYNCH_NAMELEN) {
+                strcpy(buf, name);
+                return buf;
+        }
+        return kstrdup(name);
+}
+
+static
+void
+synch_freename(char *buf, char *name)
+{
+        if (name != buf) {
+                kfree(name);
+        }
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -147,31 +173,56 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Locks are kept in a cache with their wait channel and spinlock
+ * already set up.
+ */
+static
+int
+lock_ctor(void *obj)
+{
+        struct lock *lock = obj;
+
+        lock->wc = wchan_create("lock");
+        if (lock->wc == NULL) {
+                return ENOMEM;
+        }
+        spinlock_init(&lock->splock);
+        return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+        struct lock *lock = obj;
+
+        spinlock_cleanup(&lock->splock);
+        wchan_destroy(lock->wc);
+}
+
+static struct kmem_cache lock_cache =
+        KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock),
+                               lock_ctor, lock_dtor);
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
 
-        lock = kmalloc(sizeof(struct lock));
+        lock = kmem_cache_alloc(&lock_cache);
         if (lock == NULL) {
                 return NULL;
         }
 
-        lock->lk_name = kstrdup(name);
+        lock->lk_name = synch_setname(lock->lk_namebuf, name);
         if (lock->lk_name == NULL) {
-                kfree(lock);
+                kmem_cache_free(&lock_cache, lock);
                 return NULL;
         }
-        
-        lock->wc = wchan_create(lock->lk_name);
-	if (lock->wc == NULL) {
-		kfree(lock->lk_name);
-		kfree(lock);
-		return NULL;
-	}
+        wchan_setname(lock->wc, lock->lk_name);
         
         // add stuff here as needed
-        spinlock_init(&lock->splock);
         lock->locked = false;
         lock->owner = NULL;
         
@@ -184,10 +235,9 @@ lock_destroy(struct lock *lock)
         KASSERT(lock != NULL);
 
         // add stuff here as needed
-        spinlock_cleanup(&lock->splock);
-	wchan_destroy(lock->wc);
-        kfree(lock->lk_name);
-        kfree(lock);
+        wchan_setname(lock->wc, "lock");
+        synch_freename(lock->lk_namebuf, lock->lk_name);
+        kmem_cache_free(&lock_cache, lock);
 }
 
 void
@@ -248,28 +298,50 @@ lock_do_i_hold(struct lock *lock)
 // CV
 
 
+/*
+ * Likewise CVs, with their wait channel.
+ */
+static
+int
+cv_ctor(void *obj)
+{
+        struct cv *cv = obj;
+
+        cv->wc = wchan_create("cv");
+        if (cv->wc == NULL) {
+                return ENOMEM;
+        }
+        return 0;
+}
+
+static
+void
+cv_dtor(void *obj)
+{
+        struct cv *cv = obj;
+
+        wchan_destroy(cv->wc);
+}
+
+static struct kmem_cache cv_cache =
+        KMEM_CACHE_INITIALIZER("cv", sizeof(struct cv), cv_ctor, cv_dtor);
+
 struct cv *
 cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = kmem_cache_alloc(&cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
-        cv->cv_name = kstrdup(name);
+        cv->cv_name = synch_setname(cv->cv_namebuf, name);
         if (cv->cv_name==NULL) {
-                kfree(cv);
+                kmem_cache_free(&cv_cache, cv);
                 return NULL;
         }
-
-        cv->wc = wchan_create(cv->cv_name);
-	if (cv->wc == NULL) {
-		kfree(cv->cv_name);
-		kfree(cv);
-		return NULL;
-	}
+        wchan_setname(cv->wc, cv->cv_name);
         
         // add stuff here as needed
         
@@ -282,9 +354,9 @@ cv_destroy(struct cv *cv)
         KASSERT(cv != NULL);
 
         // add stuff here as needed
-        wchan_destroy(cv->wc);        
-        kfree(cv->cv_name);
-        kfree(cv);
+        wchan_setname(cv->wc, "cv");
+        synch_freename(cv->cv_namebuf, cv->cv_name);
+        kmem_cache_free(&cv_cache, cv);
 }
 
 void
@@ -47,6 +47,7 @@
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <kmem_cache.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
@@ -111,27 +112,34 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/* Thread structures, recycled through a cache */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread), NULL, NULL);
+
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * On top of that, each CPU keeps up to THREAD_CACHE_MAX destroyed
+ * threads with their stacks still attached, so that a thread_fork
+ * that follows a thread_exit on the same CPU needs no allocator at
+ * all. The cache is only touched by its own CPU, with interrupts off.
+ */
+#define THREAD_CACHE_MAX 8
+
+/*
+ * Set up the fields of THREAD other than the stack. Fails only if the
+ * name is too long for t_namebuf and kstrdup runs out of memory.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_init(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < THREAD_NAMELEN) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
 	}
-
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+	else {
+		thread->t_name = kstrdup(name);
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -139,7 +147,6 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -151,9 +158,73 @@ thread_create(const char *name)
 
 	/* If you add to struct thread, be sure to initialize here */
 
+	return thread->t_name == NULL ? ENOMEM : 0;
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmem_cache_alloc(&thread_cache);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_init(thread, name)) {
+		kmem_cache_free(&thread_cache, thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
+
+	return thread;
+}
+
+/*
+ * Take a thread, stack and all, from this CPU's cache, or return
+ * NULL if there is none.
+ */
+static
+struct thread *
+thread_cache_get(void)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
 	return thread;
 }
 
+/*
+ * Put THREAD, which must have a stack, in this CPU's cache if there is
+ * room. Returns true if it went in.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	bool cached = false;
+	int spl;
+
+	KASSERT(thread->t_stack != NULL);
+	thread_checkstack(thread);
+
+	spl = splhigh();
+	if (curcpu->c_threadcache.tl_count < THREAD_CACHE_MAX) {
+		threadlist_addhead(&curcpu->c_threadcache, thread);
+		cached = true;
+	}
+	splx(spl);
+	return cached;
+}
+
 /*
  * Create a CPU structure. This is used for the bootup CPU and
  * also for secondary CPUs.
@@ -179,6 +250,7 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
 
 	c->c_isidle = false;
@@ -187,6 +259,7 @@ cpu_create(unsigned hardware_number)
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdowns_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -249,17 +322,25 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
-	kfree(thread);
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
+	thread->t_name = NULL;
+
+	/* Keep it around for the next thread_fork if we can */
+	if (thread->t_stack != NULL) {
+		if (thread_cache_put(thread)) {
+			return;
+		}
+		kfree(thread->t_stack);
+	}
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
@@ -487,18 +568,29 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
+	/* Use a thread from this CPU's cache, which has a stack, if any */
+	newthread = thread_cache_get();
+	if (newthread != NULL) {
+		result = thread_init(newthread, name);
+		if (result) {
+			thread_destroy(newthread);
+			return result;
+		}
 	}
+	else {
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -817,6 +909,19 @@ thread_yield(void)
 	thread_switch(S_READY, NULL);
 }
 
+bool
+thread_cpu_busy(void)
+{
+	struct cpu *cpu;
+	bool busy;
+
+	cpu = curcpu;
+	spinlock_acquire(&cpu->c_runqueue_lock);
+	busy = !threadlist_isempty(&cpu->c_runqueue);
+	spinlock_release(&cpu->c_runqueue_lock);
+	return busy;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -986,6 +1091,13 @@ wchan_create(const char *name)
 	return wc;
 }
 
+void
+wchan_setname(struct wchan *wc, const char *name)
+{
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	wc->wc_name = name;
+}
+
 /*
  * Destroy a wait channel. Must be empty and unlocked.
  * (The corresponding cleanup functions require this.)
@@ -1162,6 +1274,64 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+void
+ipi_tlbshootdown_wait(uint32_t cpumask,
+		      const struct tlbshootdown *mappings, unsigned n)
+{
+	uint32_t ticket[32];
+	unsigned i, j, numcpus;
+	struct cpu *c;
+	bool done;
+
+	KASSERT(curthread->t_iplhigh_count == 0);
+
+	numcpus = cpuarray_num(&allcpus);
+	KASSERT(numcpus <= 32);
+	cpumask &= ~((uint32_t)1 << curcpu->c_number);
+
+	/*
+	 * Queue everything first so the CPUs work in parallel. The
+	 * batch we join is finished once the target's count of
+	 * handled shootdowns moves past the value it has now.
+	 */
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((cpumask & ((uint32_t)1 << c->c_number)) == 0) {
+			continue;
+		}
+
+		spinlock_acquire(&c->c_ipi_lock);
+		for (j=0; j<n; j++) {
+			if (c->c_numshootdown == TLBSHOOTDOWN_ALL) {
+				break;
+			}
+			if (c->c_numshootdown == TLBSHOOTDOWN_MAX) {
+				c->c_numshootdown = TLBSHOOTDOWN_ALL;
+				break;
+			}
+			c->c_shootdown[c->c_numshootdown++] = mappings[j];
+		}
+		ticket[c->c_number] = c->c_shootdowns_done;
+		c->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+		mainbus_send_ipi(c);
+		spinlock_release(&c->c_ipi_lock);
+	}
+
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((cpumask & ((uint32_t)1 << c->c_number)) == 0) {
+			continue;
+		}
+
+		/* Spin with interrupts on, so we can answer them too */
+		do {
+			spinlock_acquire(&c->c_ipi_lock);
+			done = c->c_shootdowns_done != ticket[c->c_number];
+			spinlock_release(&c->c_ipi_lock);
+		} while (!done);
+	}
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -1202,6 +1372,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdowns_done++;
 	}
 
 	curcpu->c_ipi_pending = 0;
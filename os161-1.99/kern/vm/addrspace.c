@@ -0,0 +1,738 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <spl.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <asid.h>
+#include <swap.h>
+
+/*
+ * Address spaces for the paged VM system.
+ *
+ * Unlike dumbvm, nothing is allocated up front: each address space
+ * just records its regions, and vm_fault fills in the page table one
+ * frame at a time as pages are first touched. Even the executable is
+ * only read a page at a time, as the program uses it.
+ */
+
+/*
+ * Index of the first region that ends above VADDR, which is where a
+ * region containing VADDR would be; the number of regions if there is
+ * none.
+ */
+static
+unsigned
+as_search(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned lo, hi, mid;
+	struct region *rg;
+
+	lo = 0;
+	hi = array_num(&as->as_regions);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		rg = array_get(&as->as_regions, mid);
+		if (RG_END(rg) <= vaddr) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+struct region *
+as_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned i;
+
+	rg = as->as_lasthit;
+	if (rg != NULL && vaddr >= rg->rg_vbase && vaddr < RG_END(rg)) {
+		return rg;
+	}
+
+	i = as_search(as, vaddr);
+	if (i == array_num(&as->as_regions)) {
+		return NULL;
+	}
+	rg = array_get(&as->as_regions, i);
+	if (vaddr < rg->rg_vbase) {
+		return NULL;
+	}
+	as->as_lasthit = rg;
+	return rg;
+}
+
+/*
+ * Put RG into the region list, keeping it sorted. Regions may not
+ * overlap.
+ */
+static
+int
+as_addregion(struct addrspace *as, struct region *rg)
+{
+	struct region *next;
+	unsigned i, j;
+	int result;
+
+	i = as_search(as, rg->rg_vbase);
+	if (i < array_num(&as->as_regions)) {
+		next = array_get(&as->as_regions, i);
+		if (next->rg_vbase < RG_END(rg)) {
+			return EINVAL;
+		}
+	}
+
+	result = array_add(&as->as_regions, NULL, NULL);
+	if (result) {
+		return result;
+	}
+	for (j = array_num(&as->as_regions) - 1; j > i; j--) {
+		array_set(&as->as_regions, j,
+			  array_get(&as->as_regions, j - 1));
+	}
+	array_set(&as->as_regions, i, rg);
+	return 0;
+}
+
+/*
+ * Take region I out of the list and free it, dropping its reference
+ * to its file.
+ */
+static
+void
+as_removeregion(struct addrspace *as, unsigned i)
+{
+	struct region *rg;
+
+	rg = array_get(&as->as_regions, i);
+	if (as->as_lasthit == rg) {
+		as->as_lasthit = NULL;
+	}
+	array_remove(&as->as_regions, i);
+	if (rg->rg_vnode != NULL) {
+		VOP_DECREF(rg->rg_vnode);
+	}
+	kfree(rg);
+}
+
+int
+as_writepage(struct region *rg, vaddr_t vaddr, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t lo, hi;
+
+	KASSERT(rg->rg_vnode != NULL);
+
+	/* Only the part of the page that is in the file goes back */
+	lo = vaddr > rg->rg_filevbase ? vaddr : rg->rg_filevbase;
+	hi = vaddr + PAGE_SIZE;
+	if (hi > rg->rg_filevbase + rg->rg_filesize) {
+		hi = rg->rg_filevbase + rg->rg_filesize;
+	}
+	if (lo >= hi) {
+		return 0;
+	}
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr + (lo - vaddr)),
+		  hi - lo, rg->rg_offset + (lo - rg->rg_filevbase), UIO_WRITE);
+	return VOP_WRITE(rg->rg_vnode, &ku);
+}
+
+/*
+ * Write every dirty resident page of shared mapping RG back to its
+ * file. The pages stay mapped.
+ */
+static
+void
+as_syncregion(struct addrspace *as, struct region *rg)
+{
+	vaddr_t va;
+	pte_t *pte;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	for (va = rg->rg_vbase; va < RG_END(rg); va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || (*pte & (PTE_VALID|PTE_DIRTY)) !=
+		    (PTE_VALID|PTE_DIRTY)) {
+			continue;
+		}
+		result = as_writepage(rg, va, *pte & PTE_FRAME);
+		if (result) {
+			kprintf("vm: writing back mapped page 0x%x: %s\n",
+				va, strerror(result));
+		}
+	}
+}
+
+/*
+ * Drop the N pages in VADDRS, whose page table entries have already
+ * been cleared (their old values are in PTES), from every TLB, and
+ * then free what they held. Dirty pages of a shared mapping RG are
+ * written back to the file first.
+ */
+static
+void
+as_release(struct addrspace *as, struct region *rg, const vaddr_t *vaddrs,
+	   const pte_t *ptes, unsigned n)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	asid_shootdown(as, vaddrs, n);
+	for (i = 0; i < n; i++) {
+		if (ptes[i] & PTE_VALID) {
+			if (rg != NULL && rg->rg_mmapflags == MAP_SHARED &&
+			    (ptes[i] & PTE_DIRTY)) {
+				result = as_writepage(rg, vaddrs[i],
+						      ptes[i] & PTE_FRAME);
+				if (result) {
+					kprintf("vm: writing back mapped "
+						"page 0x%x: %s\n",
+						vaddrs[i], strerror(result));
+				}
+			}
+			freeppages(ptes[i] & PTE_FRAME);
+		}
+		else {
+			swap_free(PTE_SLOT(ptes[i]));
+		}
+	}
+}
+
+/*
+ * Take the pages in [START, END) out of the page table and free them
+ * (see as_release).
+ */
+static
+void
+as_unmap(struct addrspace *as, struct region *rg, vaddr_t start, vaddr_t end)
+{
+	vaddr_t vaddrs[TLBSHOOTDOWN_MAX];
+	pte_t ptes[TLBSHOOTDOWN_MAX];
+	vaddr_t va;
+	pte_t *pte;
+	unsigned n;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	n = 0;
+	for (va = start; va < end; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || (*pte & (PTE_VALID|PTE_SWAPPED)) == 0) {
+			continue;
+		}
+		vaddrs[n] = va;
+		ptes[n] = *pte;
+		*pte = 0;
+		n++;
+
+		if (n == TLBSHOOTDOWN_MAX) {
+			as_release(as, rg, vaddrs, ptes, n);
+			n = 0;
+		}
+	}
+	as_release(as, rg, vaddrs, ptes, n);
+}
+
+struct addrspace *
+as_create(void)
+{
+	unsigned i;
+	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	if (as==NULL) {
+		return NULL;
+	}
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	array_init(&as->as_regions);
+	as->as_lasthit = NULL;
+	as->as_stackbase = USERSTACK;
+	as->as_heapbase = 0;
+	as->as_heaptop = 0;
+	for (i = 0; i < ASID_MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+	as->as_cpumask = 0;
+	as->elf_loaded = false;
+
+	return as;
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	struct pagetable *pt = as->as_pt;
+	struct region *rg;
+	unsigned i, j;
+	pte_t pte;
+
+	lock_acquire(vm_lock);
+	for (i = 0; i < array_num(&as->as_regions); i++) {
+		rg = array_get(&as->as_regions, i);
+		if (rg->rg_mmapflags == MAP_SHARED) {
+			as_syncregion(as, rg);
+		}
+	}
+	for (i = 0; i < PT_L1_ENTRIES; i++) {
+		if (pt->pt_dir[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_L2_ENTRIES; j++) {
+			pte = pt->pt_dir[i][j];
+			if (pte & PTE_VALID) {
+				freeppages(pte & PTE_FRAME);
+			}
+			else if (pte & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(pte));
+			}
+		}
+	}
+	lock_release(vm_lock);
+	pt_destroy(pt);
+	while (array_num(&as->as_regions) > 0) {
+		as_removeregion(as, array_num(&as->as_regions) - 1);
+	}
+	array_cleanup(&as->as_regions);
+	kfree(as);
+}
+
+void
+as_countpages(struct addrspace *as, unsigned *resident, unsigned *swapped)
+{
+	struct pagetable *pt = as->as_pt;
+	unsigned i, j;
+	pte_t pte;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	*resident = 0;
+	*swapped = 0;
+	for (i = 0; i < PT_L1_ENTRIES; i++) {
+		if (pt->pt_dir[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_L2_ENTRIES; j++) {
+			pte = pt->pt_dir[i][j];
+			if (pte & PTE_VALID) {
+				(*resident)++;
+			}
+			else if (pte & PTE_SWAPPED) {
+				(*swapped)++;
+			}
+		}
+	}
+}
+
+void
+as_activate(void)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/* Kernel threads don't have an address spaces to activate */
+		return;
+	}
+
+	/* The TLB is tagged with ASIDs, so there is no need to flush it */
+	asid_activate(as);
+}
+
+void
+as_deactivate(void)
+{
+	/* nothing */
+}
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	struct region *rg;
+	int result;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	/* Pages are filled from the kernel, so check this explicitly */
+	if (vaddr >= USERSPACETOP || sz > USERSPACETOP - vaddr) {
+		return EFAULT;
+	}
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = sz / PAGE_SIZE;
+	rg->rg_prot = (readable ? PROT_READ : 0) |
+		(writeable ? PROT_WRITE : 0) |
+		(executable ? PROT_EXEC : 0);
+	rg->rg_filevbase = vaddr;
+	rg->rg_filesize = 0;
+	rg->rg_offset = 0;
+	rg->rg_vnode = NULL;
+	rg->rg_mmapflags = 0;
+
+	result = as_addregion(as, rg);
+	if (result) {
+		if (result == EINVAL) {
+			kprintf("vm: Warning: overlapping regions\n");
+		}
+		kfree(rg);
+		return result;
+	}
+	return 0;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Nothing is loaded here; see as_define_file. */
+	(void)as;
+	return 0;
+}
+
+int
+as_define_file(struct addrspace *as, struct vnode *v,
+	       vaddr_t vaddr, off_t offset, size_t filesize)
+{
+	struct region *rg;
+
+	rg = as_region(as, vaddr);
+	if (rg == NULL || filesize > RG_END(rg) - vaddr) {
+		return ENOEXEC;
+	}
+
+	if (rg->rg_vnode == NULL) {
+		VOP_INCREF(v);
+		rg->rg_vnode = v;
+	}
+	KASSERT(rg->rg_vnode == v);
+
+	rg->rg_filevbase = vaddr;
+	rg->rg_filesize = filesize;
+	rg->rg_offset = offset;
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+	unsigned n;
+
+	as->elf_loaded = true;
+
+	/* The heap starts out empty, just past the highest region */
+	as->as_heapbase = 0;
+	n = array_num(&as->as_regions);
+	if (n > 0) {
+		as->as_heapbase = RG_END((struct region *)
+					 array_get(&as->as_regions, n - 1));
+	}
+	as->as_heaptop = as->as_heapbase;
+
+	/*
+	 * Any TLB entries made while loading may be writable even in
+	 * read-only regions. Drop those.
+	 */
+	asid_flush(as);
+	return 0;
+}
+
+/*
+ * The break moves a byte at a time, but the heap is mapped in whole
+ * pages: [as_heapbase, ROUNDUP(as_heaptop)). Growing only moves the
+ * break; vm_fault zero-fills the new pages when they are touched.
+ * Shrinking takes the pages past the new break out of the page table,
+ * drops them from every TLB, and only then frees them.
+ */
+int
+as_sbrk(struct addrspace *as, int amount, vaddr_t *oldbreak)
+{
+	struct region *rg;
+	vaddr_t oldtop, newtop, limit;
+	unsigned i;
+
+	oldtop = as->as_heaptop;
+	if (amount < 0) {
+		if (-(vaddr_t)amount > oldtop - as->as_heapbase) {
+			return EINVAL;
+		}
+	}
+	else {
+		/* Stop a guard page short of the lowest mapping */
+		limit = VM_MMAPTOP;
+		i = as_search(as, oldtop);
+		if (i < array_num(&as->as_regions)) {
+			rg = array_get(&as->as_regions, i);
+			if (rg->rg_vbase < limit) {
+				limit = rg->rg_vbase;
+			}
+		}
+		limit -= PAGE_SIZE;
+		if (oldtop > limit || (vaddr_t)amount > limit - oldtop) {
+			return ENOMEM;
+		}
+	}
+	newtop = oldtop + amount;
+
+	*oldbreak = oldtop;
+	as->as_heaptop = newtop;
+	if (amount < 0) {
+		lock_acquire(vm_lock);
+		as_unmap(as, NULL, ROUNDUP(newtop, PAGE_SIZE),
+			 ROUNDUP(oldtop, PAGE_SIZE));
+		lock_release(vm_lock);
+	}
+	return 0;
+}
+
+/*
+ * Mappings are placed as high as they fit below VM_MMAPTOP, and must
+ * stay a guard page above the heap.
+ */
+int
+as_mmap(struct addrspace *as, struct vnode *v, size_t len, int prot,
+	int flags, off_t offset, off_t filesize, vaddr_t *vaddr)
+{
+	struct region *rg, *other;
+	vaddr_t top;
+	size_t sz;
+	unsigned i;
+	int result;
+
+	sz = ROUNDUP(len, PAGE_SIZE);
+	if (len == 0 || sz < len) {
+		return EINVAL;
+	}
+
+	/* Walk down from the top for the first gap that is big enough */
+	top = VM_MMAPTOP;
+	for (i = array_num(&as->as_regions); i > 0; i--) {
+		other = array_get(&as->as_regions, i - 1);
+		if (other->rg_vbase >= top) {
+			continue;
+		}
+		if (top < sz || RG_END(other) <= top - sz) {
+			break;
+		}
+		top = other->rg_vbase;
+	}
+	if (top < sz || top - sz < ROUNDUP(as->as_heaptop, PAGE_SIZE) +
+	    PAGE_SIZE) {
+		return ENOMEM;
+	}
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = top - sz;
+	rg->rg_npages = sz / PAGE_SIZE;
+	rg->rg_prot = prot;
+	rg->rg_filevbase = rg->rg_vbase;
+	rg->rg_filesize = 0;
+	if (offset < filesize) {
+		rg->rg_filesize = filesize - offset < (off_t)len ?
+			filesize - offset : len;
+	}
+	rg->rg_offset = offset;
+	rg->rg_vnode = v;
+	rg->rg_mmapflags = flags;
+	VOP_INCREF(v);
+
+	/* Region list changes are seen by pageout, which holds vm_lock */
+	lock_acquire(vm_lock);
+	result = as_addregion(as, rg);
+	lock_release(vm_lock);
+	if (result) {
+		VOP_DECREF(v);
+		kfree(rg);
+		return result;
+	}
+
+	*vaddr = rg->rg_vbase;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	vaddr_t end;
+	unsigned i;
+
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != 0 || len == 0) {
+		return EINVAL;
+	}
+	end = ROUNDUP(vaddr + len, PAGE_SIZE);
+	if (end <= vaddr) {
+		return EINVAL;
+	}
+
+	/* Mappings may only be removed whole */
+	for (i = as_search(as, vaddr); i < array_num(&as->as_regions); i++) {
+		rg = array_get(&as->as_regions, i);
+		if (rg->rg_vbase >= end) {
+			break;
+		}
+		if (rg->rg_mmapflags != 0 &&
+		    (rg->rg_vbase < vaddr || RG_END(rg) > end)) {
+			return EINVAL;
+		}
+	}
+
+	lock_acquire(vm_lock);
+	i = as_search(as, vaddr);
+	while (i < array_num(&as->as_regions)) {
+		rg = array_get(&as->as_regions, i);
+		if (rg->rg_vbase >= end) {
+			break;
+		}
+		if (rg->rg_mmapflags == 0) {
+			i++;
+			continue;
+		}
+		as_unmap(as, rg, rg->rg_vbase, RG_END(rg));
+		as_removeregion(as, i);
+	}
+	lock_release(vm_lock);
+	return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	/* The stack starts out empty and grows as vm_fault sees it used. */
+	as->as_stackbase = USERSTACK;
+	*stackptr = USERSTACK;
+	return 0;
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	struct pagetable *opt = old->as_pt;
+	struct region *rg, *nrg;
+	unsigned i, j, slot;
+	pte_t *pte;
+	paddr_t paddr;
+	int result;
+
+	new = as_create();
+	if (new==NULL) {
+		return ENOMEM;
+	}
+
+	for (i = 0; i < array_num(&old->as_regions); i++) {
+		rg = array_get(&old->as_regions, i);
+		nrg = kmalloc(sizeof(struct region));
+		if (nrg == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		*nrg = *rg;
+		if (nrg->rg_vnode != NULL) {
+			VOP_INCREF(nrg->rg_vnode);
+		}
+		result = array_add(&new->as_regions, nrg, NULL);
+		if (result) {
+			if (nrg->rg_vnode != NULL) {
+				VOP_DECREF(nrg->rg_vnode);
+			}
+			kfree(nrg);
+			as_destroy(new);
+			return result;
+		}
+	}
+	new->as_stackbase = old->as_stackbase;
+	new->as_heapbase = old->as_heapbase;
+	new->as_heaptop = old->as_heaptop;
+	new->elf_loaded = old->elf_loaded;
+
+	/*
+	 * Share every resident page copy-on-write rather than copying it.
+	 * Both sides get PTE_COW; whoever writes first takes a copy.
+	 * Pages out in swap get a swap slot of their own.
+	 *
+	 * Pages of a MAP_SHARED mapping are shared as they are, writable
+	 * by both: they must stay one page, and a copy left behind with
+	 * PTE_DIRTY would be written back over later changes.
+	 */
+	lock_acquire(vm_lock);
+	for (i = 0; i < PT_L1_ENTRIES; i++) {
+		if (opt->pt_dir[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_L2_ENTRIES; j++) {
+			if ((opt->pt_dir[i][j] & (PTE_VALID|PTE_SWAPPED)) == 0) {
+				continue;
+			}
+
+			pte = pt_lookup(new->as_pt, PT_VADDR(i, j), true);
+			if (pte == NULL) {
+				lock_release(vm_lock);
+				as_destroy(new);
+				return ENOMEM;
+			}
+
+			if (opt->pt_dir[i][j] & PTE_SWAPPED) {
+				result = swap_copy(PTE_SLOT(opt->pt_dir[i][j]),
+						   &slot);
+				if (result) {
+					lock_release(vm_lock);
+					as_destroy(new);
+					return result;
+				}
+				*pte = PTE_MKSWAP(slot);
+				continue;
+			}
+
+			paddr = opt->pt_dir[i][j] & PTE_FRAME;
+			coremap_incref(paddr);
+			rg = as_region(old, PT_VADDR(i, j));
+			if (rg == NULL || rg->rg_mmapflags != MAP_SHARED) {
+				opt->pt_dir[i][j] |= PTE_COW;
+			}
+			*pte = opt->pt_dir[i][j];
+		}
+	}
+	lock_release(vm_lock);
+
+	/*
+	 * The parent may still have writable TLB entries for pages that
+	 * are now shared. Flush them so its next write faults.
+	 */
+	asid_flush(old);
+
+	*ret = new;
+	return 0;
+}
@@ -0,0 +1,186 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <asid.h>
+#include <uw-vmstats.h>
+
+/*
+ * as_asid[N] holds the generation in its upper bits and the hardware
+ * ID on CPU N in the low ones. Generations count up in steps of
+ * NUM_ASID starting from NUM_ASID, so 0 is never a valid ID.
+ */
+#define ASID_ID(asid)   ((asid) & (NUM_ASID - 1))
+#define ASID_GEN(asid)  ((asid) & ~(NUM_ASID - 1))
+
+struct asid_cpu {
+	unsigned ac_generation;		/* current generation (0 = unused yet) */
+	unsigned ac_next;		/* next free ID in it */
+	struct addrspace *ac_current;	/* last one activated here */
+};
+
+static struct asid_cpu asid_cpus[ASID_MAXCPUS];
+
+/*
+ * Protects asid_cpus and the ASID fields of every address space; also
+ * keeps interrupts off while we frob the TLB.
+ */
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Is AS's ID on this CPU from the current generation? Call with
+ * interrupts off, so we stay on this CPU.
+ */
+static
+bool
+asid_live(struct addrspace *as)
+{
+	struct asid_cpu *ac = &asid_cpus[curcpu->c_number];
+
+	return ac->ac_generation != 0 &&
+		ASID_GEN(as->as_asid[curcpu->c_number]) == ac->ac_generation;
+}
+
+/*
+ * Load AS's ID into the TLB, giving it a new one first if it is stale.
+ * Call with asid_lock held.
+ */
+static
+void
+asid_load(struct addrspace *as)
+{
+	struct asid_cpu *ac;
+	unsigned cpu;
+
+	cpu = curcpu->c_number;
+	KASSERT(cpu < ASID_MAXCPUS);
+	ac = &asid_cpus[cpu];
+
+	if (!asid_live(as)) {
+		if (ac->ac_generation == 0) {
+			ac->ac_generation = NUM_ASID;
+		}
+		else if (ac->ac_next == NUM_ASID) {
+			/* Out of IDs: start a new generation */
+			ac->ac_generation += NUM_ASID;
+			ac->ac_next = 0;
+			tlb_invalidate_all();
+			vmstats_inc(VMSTAT_TLB_INVALIDATE);
+		}
+		as->as_asid[cpu] = ac->ac_generation | ac->ac_next++;
+		as->as_cpumask |= (uint32_t)1 << cpu;
+	}
+	tlb_setpid(ASID_ID(as->as_asid[cpu]));
+	ac->ac_current = as;
+}
+
+void
+asid_activate(struct addrspace *as)
+{
+	struct asid_cpu *ac;
+
+	spinlock_acquire(&asid_lock);
+
+	/*
+	 * Only count a switch when this CPU last ran some other address
+	 * space. One without an ID here is new, even if it was allocated
+	 * where the last one used to be.
+	 */
+	KASSERT(curcpu->c_number < ASID_MAXCPUS);
+	ac = &asid_cpus[curcpu->c_number];
+	if (ac->ac_current != as || !asid_live(as)) {
+		vmstats_inc(VMSTAT_AS_SWITCH);
+	}
+	asid_load(as);
+
+	spinlock_release(&asid_lock);
+}
+
+void
+asid_flush(struct addrspace *as)
+{
+	bool current;
+	unsigned i;
+
+	current = as == curproc_getas();
+
+	/*
+	 * The old IDs are never handed out again before the CPU's next
+	 * rollover flush, so the entries tagged with them are dead.
+	 */
+	spinlock_acquire(&asid_lock);
+	for (i=0; i<ASID_MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+	as->as_cpumask = 0;
+
+	/* Still the same address space, so not a switch */
+	if (current) {
+		asid_load(as);
+	}
+	spinlock_release(&asid_lock);
+}
+
+uint32_t
+asid_entryhi(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned id = ASID_ID(as->as_asid[curcpu->c_number]);
+
+	KASSERT(curthread->t_iplhigh_count > 0);
+	KASSERT(asid_live(as));
+	return (vaddr & TLBHI_VPAGE) | (id << TLBHI_PIDSHIFT);
+}
+
+void
+asid_tlb_drop(struct addrspace *as, vaddr_t vaddr)
+{
+	int i;
+
+	spinlock_acquire(&asid_lock);
+
+	/* An address space with a stale ID has nothing in the TLB */
+	if (asid_live(as)) {
+		i = tlb_probe(asid_entryhi(as, vaddr), 0);
+		if (i >= 0) {
+			tlb_invalidate(i);
+		}
+	}
+
+	spinlock_release(&asid_lock);
+}
+
+void
+asid_shootdown(struct addrspace *as, const vaddr_t *vaddrs, unsigned n)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	uint32_t cpumask;
+	unsigned i, batch;
+
+	for (i=0; i<n; i++) {
+		asid_tlb_drop(as, vaddrs[i]);
+	}
+
+	spinlock_acquire(&asid_lock);
+	cpumask = as->as_cpumask & ~((uint32_t)1 << curcpu->c_number);
+	spinlock_release(&asid_lock);
+
+	if (cpumask == 0) {
+		return;
+	}
+
+	while (n > 0) {
+		batch = n < TLBSHOOTDOWN_MAX ? n : TLBSHOOTDOWN_MAX;
+		for (i=0; i<batch; i++) {
+			ts[i].ts_addrspace = as;
+			ts[i].ts_vaddr = vaddrs[i];
+		}
+		ipi_tlbshootdown_wait(cpumask, ts, batch);
+		vaddrs += batch;
+		n -= batch;
+	}
+}
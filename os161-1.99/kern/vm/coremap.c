@@ -0,0 +1,617 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <coremap.h>
+
+/*
+ * The coremap tracks every physical frame from the end of the kernel
+ * image to the top of RAM, and hands them out with a buddy allocator:
+ * free memory is kept as blocks of 2^order frames, aligned to their
+ * size, on one free list per order. An allocation takes the smallest
+ * block that fits, splitting larger ones as needed; a free merges the
+ * block with its buddy for as long as the buddy is free too. Frame N
+ * lives at starting_point + N * PAGE_SIZE, so looking up the frame for
+ * an address is just arithmetic.
+ *
+ * Frames handed out by ram_stealmem before coremap_bootstrap runs are
+ * taken over as allocated single frames, so freeing them later works
+ * like freeing anything else. A stolen run of several frames is freed
+ * frame by frame; the frames after the first are marked f_cont.
+ *
+ * User frames can be shared copy-on-write between address spaces after
+ * fork. Each block carries a reference count on its first frame;
+ * freeppages drops one reference and only releases the block when the
+ * last one goes away.
+ *
+ * A user frame that belongs to exactly one address space also records
+ * which page it holds, so that the pageout code can find the page
+ * table entry to update. Frames without an owner (kernel memory, pages
+ * shared copy-on-write, pages still being filled) are never evicted.
+ *
+ * A kernel frame can instead carry a tag for its allocator: kmalloc
+ * tags the pages it carves into small blocks with their pageref, so
+ * that kfree can tell what a pointer is without searching.
+ */
+
+/* Largest block is 2^BUDDY_MAXORDER frames (4MB) */
+#define BUDDY_MAXORDER  10
+#define BUDDY_ORDERS    (BUDDY_MAXORDER + 1)
+
+/* Block states */
+#define FS_FREE    0	/* on a free list */
+#define FS_USED    1	/* allocated, one reference */
+#define FS_SHARED  2	/* allocated, f_u.refcount references */
+#define FS_TAGGED  3	/* allocated, one reference, f_u.tag set */
+
+/* f_link value for "no previous block" */
+#define FRAME_NONE 0xfffff
+
+/*
+ * Everything is only kept on a block's first frame. The state says
+ * which member of f_u is live and what f_link means:
+ *
+ *    FS_FREE   - f_u.next and f_link are the free list links. Frames
+ *                inside a block (free or not) are FS_FREE too, with
+ *                order 0 and nothing else set; see frame_interior.
+ *    FS_USED   - f_u.owner is the address space mapping the frame, if
+ *                it can be evicted, and f_link the page it holds there.
+ *    FS_SHARED - f_u.refcount counts the references (at least 2).
+ *    FS_TAGGED - f_u.tag is the tag set by coremap_settag.
+ */
+struct frame {
+	union {
+		int next;
+		struct addrspace *owner;
+		unsigned refcount;
+		void *tag;
+	} f_u;
+	unsigned f_link : 20;		/* prev free block / virtual page number */
+	unsigned f_order : 4;		/* block is 2^order frames long */
+	unsigned f_state : 2;
+	unsigned f_referenced : 1;	/* used since the clock hand last passed */
+	unsigned f_cont : 1;		/* continues a stolen run */
+};
+
+struct coremap {
+	int size; //Number of frames
+	struct frame *frames;
+	paddr_t starting_point;
+	int freelist[BUDDY_ORDERS];	// First free block of each order, or -1
+	unsigned nfree[BUDDY_ORDERS];	// Length of each free list
+};
+
+static struct coremap master_core;
+static bool has_not_run = true;
+static int clock_hand;
+
+/*
+ * Runs of more than one frame stolen before bootstrap, so that they
+ * can be marked. Further ones are taken over as single frames whose
+ * tails are never freed.
+ */
+#define MAXSTOLENRUNS 16
+
+static struct {
+	paddr_t sr_paddr;
+	unsigned long sr_npages;
+} stolen_runs[MAXSTOLENRUNS];
+static unsigned nstolen_runs;
+
+/*
+ * Protects the coremap (and wraps ram_stealmem before bootstrap).
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+static
+void
+freelist_push(int ix, unsigned order)
+{
+	struct frame *f = &master_core.frames[ix];
+	int head = master_core.freelist[order];
+
+	f->f_order = order;
+	f->f_state = FS_FREE;
+	f->f_referenced = 0;
+	f->f_cont = 0;
+	f->f_link = FRAME_NONE;
+	f->f_u.next = head;
+	if (head >= 0) {
+		master_core.frames[head].f_link = ix;
+	}
+	master_core.freelist[order] = ix;
+	master_core.nfree[order]++;
+}
+
+static
+void
+freelist_remove(int ix)
+{
+	struct frame *f = &master_core.frames[ix];
+	int prev;
+
+	KASSERT(f->f_state == FS_FREE);
+	prev = f->f_link == FRAME_NONE ? -1 : (int)f->f_link;
+	if (prev >= 0) {
+		master_core.frames[prev].f_u.next = f->f_u.next;
+	}
+	else {
+		master_core.freelist[f->f_order] = f->f_u.next;
+	}
+	if (f->f_u.next >= 0) {
+		master_core.frames[f->f_u.next].f_link = f->f_link;
+	}
+	/* No longer a free block's head; the caller says what it is now */
+	f->f_state = FS_USED;
+	master_core.nfree[f->f_order]--;
+}
+
+/*
+ * Reset IX, which is no longer the first frame of a block, so that
+ * nothing stale is left in it for the clock hand or freeppages to find.
+ * A frame like this can never look like a free buddy: any block next
+ * to it lies inside the same bigger block.
+ */
+static
+void
+frame_interior(int ix)
+{
+	struct frame *f = &master_core.frames[ix];
+
+	f->f_order = 0;
+	f->f_state = FS_FREE;
+	f->f_referenced = 0;
+	f->f_cont = 0;
+	f->f_link = FRAME_NONE;
+	f->f_u.owner = NULL;
+}
+
+/*
+ * Mark the block at IX as allocated with one reference and no owner.
+ */
+static
+void
+frame_alloc(int ix, unsigned order)
+{
+	struct frame *f = &master_core.frames[ix];
+
+	f->f_order = order;
+	f->f_state = FS_USED;
+	f->f_referenced = 0;
+	f->f_cont = 0;
+	f->f_link = 0;
+	f->f_u.owner = NULL;
+}
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t base, low, high;
+	unsigned order, r;
+	int total, first, i, j;
+
+	COMPILE_ASSERT(sizeof(struct frame) <= 8);
+
+	/* Everything from base to low was stolen before we got here */
+	base = ram_getfirstfree();
+	ram_getsize(&low, &high);
+	KASSERT(base <= low);
+
+	/* The coremap goes in the first free frames; never hand those out. */
+	total = (high - base) / PAGE_SIZE;
+	master_core.starting_point = base;
+	master_core.size = total;
+	master_core.frames = (struct frame *) PADDR_TO_KVADDR(low);
+	first = (ROUNDUP(low + sizeof(struct frame) * total, PAGE_SIZE) -
+		 base) / PAGE_SIZE;
+
+	for (order = 0; order < BUDDY_ORDERS; order++) {
+		master_core.freelist[order] = -1;
+		master_core.nfree[order] = 0;
+	}
+
+	/* Stolen frames and the coremap itself are allocated single frames */
+	for (i = 0; i < first; i++) {
+		frame_alloc(i, 0);
+	}
+	for (r = 0; r < nstolen_runs; r++) {
+		i = (stolen_runs[r].sr_paddr - base) / PAGE_SIZE;
+		for (j = 1; j < (int)stolen_runs[r].sr_npages; j++) {
+			master_core.frames[i + j].f_cont = 1;
+		}
+	}
+	for (i = first; i < total; i++) {
+		frame_interior(i);
+	}
+
+	/* Carve the rest into the largest aligned blocks that fit */
+	i = first;
+	while (i < master_core.size) {
+		order = 0;
+		while (order < BUDDY_MAXORDER &&
+		       (i & ((1 << (order + 1)) - 1)) == 0 &&
+		       i + (1 << (order + 1)) <= master_core.size) {
+			order++;
+		}
+		freelist_push(i, order);
+		i += 1 << order;
+	}
+
+	has_not_run = false;
+
+	/* Now that there are frames to tag, kmalloc can tag its pages */
+	kheap_bootstrap();
+}
+
+paddr_t
+getppages(unsigned long npages)
+{
+	paddr_t addr = 0;
+	unsigned order, j;
+	int ix;
+
+	if (has_not_run == true) {
+		spinlock_acquire(&stealmem_lock);
+		addr = ram_stealmem(npages);
+		if (addr != 0 && npages > 1 && nstolen_runs < MAXSTOLENRUNS) {
+			stolen_runs[nstolen_runs].sr_paddr = addr;
+			stolen_runs[nstolen_runs].sr_npages = npages;
+			nstolen_runs++;
+		}
+		spinlock_release(&stealmem_lock);
+		return addr;
+	}
+
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (order > BUDDY_MAXORDER) {
+		return 0;
+	}
+
+	spinlock_acquire(&stealmem_lock);
+
+	/* Smallest free block that is big enough */
+	for (j = order; j < BUDDY_ORDERS; j++) {
+		if (master_core.freelist[j] >= 0) {
+			break;
+		}
+	}
+	if (j == BUDDY_ORDERS) {
+		spinlock_release(&stealmem_lock);
+		return 0;
+	}
+
+	ix = master_core.freelist[j];
+	freelist_remove(ix);
+
+	/* Give back the upper halves until it is the right size */
+	while (j > order) {
+		j--;
+		freelist_push(ix + (1 << j), j);
+	}
+
+	frame_alloc(ix, order);
+	addr = master_core.starting_point + (paddr_t)ix * PAGE_SIZE;
+
+	spinlock_release(&stealmem_lock);
+	return addr;
+}
+
+/*
+ * Find the coremap index of the frame at PADDR, or -1 if PADDR is not
+ * managed by the coremap.
+ */
+static
+int
+frame_index(paddr_t paddr)
+{
+	if (paddr < master_core.starting_point) {
+		return -1;
+	}
+	paddr -= master_core.starting_point;
+	if (paddr / PAGE_SIZE >= (paddr_t)master_core.size) {
+		return -1;
+	}
+	return paddr / PAGE_SIZE;
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	struct frame *f;
+	int counter;
+
+	spinlock_acquire(&stealmem_lock);
+	counter = frame_index(paddr);
+	KASSERT(counter >= 0);
+	f = &master_core.frames[counter];
+	KASSERT(f->f_state != FS_FREE);
+	/* Shared frames cannot be paged out, so the owner goes */
+	if (f->f_state == FS_USED) {
+		f->f_state = FS_SHARED;
+		f->f_u.refcount = 2;
+	}
+	else {
+		f->f_u.refcount++;
+	}
+	spinlock_release(&stealmem_lock);
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	struct frame *f;
+	unsigned refs;
+	int counter;
+
+	spinlock_acquire(&stealmem_lock);
+	counter = frame_index(paddr);
+	KASSERT(counter >= 0);
+	f = &master_core.frames[counter];
+	switch (f->f_state) {
+	    case FS_USED:
+	    case FS_TAGGED:
+		refs = 1;
+		break;
+	    case FS_SHARED:
+		refs = f->f_u.refcount;
+		break;
+	    default:
+		refs = 0;
+		break;
+	}
+	spinlock_release(&stealmem_lock);
+	return refs;
+}
+
+/*
+ * Put the block of 2^ORDER frames at IX back on the free lists,
+ * merging with its buddy for as long as the buddy is free and whole.
+ */
+static
+void
+frame_release(int ix, unsigned order)
+{
+	int buddy;
+
+	while (order < BUDDY_MAXORDER) {
+		buddy = ix ^ (1 << order);
+		if (buddy >= master_core.size ||
+		    master_core.frames[buddy].f_state != FS_FREE ||
+		    master_core.frames[buddy].f_order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		if (buddy < ix) {
+			frame_interior(ix);
+			ix = buddy;
+		}
+		else {
+			frame_interior(buddy);
+		}
+		order++;
+	}
+	freelist_push(ix, order);
+}
+
+void
+freeppages(paddr_t paddr)
+{
+	struct frame *f;
+	int ix;
+
+	ix = frame_index(paddr);
+	if (ix < 0) {
+		/* Not RAM we manage (the exception vectors, say) */
+		return;
+	}
+
+	spinlock_acquire(&stealmem_lock);
+
+	f = &master_core.frames[ix];
+	KASSERT(f->f_state != FS_FREE);
+	KASSERT(!f->f_cont);
+	if (f->f_state == FS_SHARED) {
+		/* Still shared copy-on-write by someone else */
+		if (--f->f_u.refcount == 1) {
+			f->f_state = FS_USED;
+			f->f_u.owner = NULL;
+		}
+		spinlock_release(&stealmem_lock);
+		return;
+	}
+
+	frame_release(ix, f->f_order);
+
+	/* The rest of a run stolen at boot goes frame by frame */
+	while (++ix < master_core.size && master_core.frames[ix].f_cont) {
+		KASSERT(master_core.frames[ix].f_state == FS_USED);
+		frame_release(ix, 0);
+	}
+
+	spinlock_release(&stealmem_lock);
+}
+
+void
+coremap_mapped(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct frame *f;
+	int counter;
+
+	spinlock_acquire(&stealmem_lock);
+	counter = frame_index(paddr);
+	KASSERT(counter >= 0);
+	f = &master_core.frames[counter];
+	KASSERT(f->f_state != FS_FREE);
+	if (f->f_state == FS_USED) {
+		f->f_u.owner = as;
+		f->f_link = vaddr / PAGE_SIZE;
+	}
+	f->f_referenced = 1;
+	spinlock_release(&stealmem_lock);
+}
+
+/*
+ * Clock (second chance) replacement. The TLB has no reference bits,
+ * so "referenced" means vm_fault mapped the page since the hand last
+ * came by. When the hand clears the bit it also has DROP remove any
+ * TLB entry for the page, so that the next use faults and sets it
+ * again.
+ */
+paddr_t
+coremap_victim(void (*drop)(struct addrspace *, vaddr_t),
+	       struct addrspace **as, vaddr_t *vaddr)
+{
+	struct frame *f;
+	paddr_t paddr = 0;
+	int i;
+
+	spinlock_acquire(&stealmem_lock);
+
+	/* Two trips round: the first may only clear reference bits */
+	for (i = 0; i < 2 * master_core.size; i++) {
+		f = &master_core.frames[clock_hand];
+		clock_hand = (clock_hand + 1) % master_core.size;
+
+		/* Only single allocated frames ever get an owner */
+		if (f->f_state != FS_USED || f->f_order != 0 ||
+		    f->f_u.owner == NULL) {
+			continue;
+		}
+		if (f->f_referenced) {
+			f->f_referenced = 0;
+			drop(f->f_u.owner, (vaddr_t)f->f_link * PAGE_SIZE);
+			continue;
+		}
+
+		*as = f->f_u.owner;
+		*vaddr = (vaddr_t)f->f_link * PAGE_SIZE;
+		/* Nobody else may pick or map it while it is paged out */
+		f->f_u.owner = NULL;
+		paddr = master_core.starting_point +
+			(paddr_t)(f - master_core.frames) * PAGE_SIZE;
+		break;
+	}
+
+	spinlock_release(&stealmem_lock);
+	return paddr;
+}
+
+/*
+ * The frames inside a block hold nothing useful, so they get the tag
+ * too; that way coremap_gettag works on any page of it. The rest of a
+ * run stolen at boot goes along as well.
+ */
+void
+coremap_settag(paddr_t paddr, void *tag)
+{
+	struct frame *f;
+	int ix, i, n;
+
+	ix = frame_index(paddr);
+	KASSERT(ix >= 0);
+
+	spinlock_acquire(&stealmem_lock);
+	f = &master_core.frames[ix];
+	KASSERT(f->f_state == FS_USED || f->f_state == FS_TAGGED);
+	KASSERT(f->f_state == FS_TAGGED || f->f_u.owner == NULL);
+	n = 1 << f->f_order;
+	for (i = 0; ix + i < master_core.size; i++) {
+		f = &master_core.frames[ix + i];
+		if (i >= n && !f->f_cont) {
+			break;
+		}
+		if (tag != NULL) {
+			f->f_state = FS_TAGGED;
+			f->f_u.tag = tag;
+		}
+		else if (i > 0 && i < n) {
+			frame_interior(ix + i);
+		}
+		else {
+			f->f_state = FS_USED;
+			f->f_u.owner = NULL;
+		}
+	}
+	spinlock_release(&stealmem_lock);
+}
+
+/*
+ * No lock: the caller owns the frame, so nobody else can be changing
+ * its entry.
+ */
+void *
+coremap_gettag(paddr_t paddr)
+{
+	struct frame *f;
+	int ix;
+
+	ix = frame_index(paddr);
+	if (ix < 0 || has_not_run) {
+		return NULL;
+	}
+	f = &master_core.frames[ix];
+	return f->f_state == FS_TAGGED ? f->f_u.tag : NULL;
+}
+
+unsigned
+coremap_nframes(void)
+{
+	return master_core.size;
+}
+
+unsigned
+coremap_nfree(void)
+{
+	unsigned order, total = 0;
+
+	spinlock_acquire(&stealmem_lock);
+	for (order = 0; order < BUDDY_ORDERS; order++) {
+		total += master_core.nfree[order] << order;
+	}
+	spinlock_release(&stealmem_lock);
+	return total;
+}
+
+void
+coremap_printstats(void)
+{
+	unsigned nfree[BUDDY_ORDERS];
+	unsigned order, total = 0;
+
+	/* kprintf can block, so copy the counts out first */
+	spinlock_acquire(&stealmem_lock);
+	for (order = 0; order < BUDDY_ORDERS; order++) {
+		nfree[order] = master_core.nfree[order];
+	}
+	spinlock_release(&stealmem_lock);
+
+	kprintf("Coremap: %d frames\n", master_core.size);
+	kprintf("order  pages  free blocks\n");
+	for (order = 0; order < BUDDY_ORDERS; order++) {
+		kprintf("%5u  %5u  %11u\n", order, 1U << order, nfree[order]);
+		total += nfree[order] << order;
+	}
+	kprintf("%u frames free\n", total);
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+	pa = getppages(npages);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	KASSERT(addr >= MIPS_KSEG0);
+	freeppages(addr - MIPS_KSEG0);
+}
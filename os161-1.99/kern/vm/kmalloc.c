@@ -30,7 +30,18 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
 #include <vm.h>
+#include <coremap.h>
+#include "opt-khprof.h"
+#if OPT_KHPROF
+#include <clock.h>
+#include <mainbus.h>
+static void khprof_bootstrap(void);
+#endif
 
 /*
  * Kernel malloc.
@@ -61,6 +72,10 @@ fill_deadbeef(void *vptr, size_t len)
 //    freecount, so we know when the page is completely free and can 
 //    release it.
 //
+//    Sizes too big to fit a page several times over are carved out of
+//    slabs of a few contiguous pages instead, which otherwise work the
+//    same way. Anything bigger than the largest size gets whole pages.
+//
 //    No assumptions are made about the sizes k; they need not be
 //    powers of two. Note, however, that malloc must always return
 //    pointers aligned to the maximum alignment requirements of the
@@ -83,11 +98,21 @@ fill_deadbeef(void *vptr, size_t len)
 
 #if PAGE_SIZE == 4096
 
-#define NSIZES 8
-static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+#define NSIZES 12
+static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048,
+				      3072, 4096, 6144, 8192 };
+
+/*
+ * Blocks of up to 2048 bytes are carved out of single pages; the
+ * larger ones out of "slabs" of several contiguous pages, as many as
+ * it takes to waste little at the end. (Slabs are a power of two pages
+ * long, as that is what the coremap hands out.)
+ */
+static const unsigned slabpages[NSIZES] = { 1, 1, 1, 1, 1, 1, 1, 1,
+					    4, 1, 8, 2 };
 
 #define SMALLEST_SUBPAGE_SIZE 16
-#define LARGEST_SUBPAGE_SIZE 2048
+#define LARGEST_SUBPAGE_SIZE 8192
 
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
@@ -113,50 +138,86 @@ struct pageref {
 
 #define PR_PAGEADDR(pr)  ((pr)->pageaddr_and_blocktype & PAGE_FRAME)
 #define PR_BLOCKTYPE(pr) ((pr)->pageaddr_and_blocktype & ~PAGE_FRAME)
+#define SLAB_SIZE(blk)   (slabpages[blk] * PAGE_SIZE)
+#define PR_SLABSIZE(pr)  SLAB_SIZE(PR_BLOCKTYPE(pr))
 #define MKPAB(pa, blk)   (((pa)&PAGE_FRAME) | ((blk) & ~PAGE_FRAME))
 
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
+ * Pagerefs live in whole pages of their own, chained together, each
+ * starting with a header that records which of its pagerefs are in
+ * use. A page of pagerefs lets us manage about 1M of kernel heap.
+ * When they are all taken another page is added (see
+ * subpage_kmalloc), so the heap can grow as far as memory does.
+ * Pages of pagerefs are never given back; they cost at most 1/250th
+ * of the most heap there ever was.
  *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * The header of the page a pageref is in is found by rounding its
+ * address down, so freeing one does not search.
+ */
+
+#define INUSE_WORDS (PAGE_SIZE / sizeof(struct pageref) / 32)
+
+struct pagerefpage {
+	struct pagerefpage *next;	/* next page of pagerefs */
+	unsigned nfree;			/* pagerefs not in use */
+	uint32_t inuse[INUSE_WORDS];	/* bit per pageref: in use */
+};
+
+#define NPAGEREFS ((PAGE_SIZE - sizeof(struct pagerefpage)) / \
+		   sizeof(struct pageref))
+#define PRP_REFS(prp) ((struct pageref *)((prp) + 1))
+
+static struct pagerefpage *pagerefpages;
+static unsigned npagerefpages;
+
+/*
+ * Add the page at PAGE to the pagerefs available.
  */
+static
+void
+addpagerefpage(vaddr_t page)
+{
+	struct pagerefpage *prp = (struct pagerefpage *)page;
+	unsigned i;
 
-#define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
+	KASSERT(page % PAGE_SIZE == 0);
+	KASSERT(NPAGEREFS <= INUSE_WORDS * 32);
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static uint32_t pagerefs_inuse[INUSE_WORDS];
+	prp->nfree = NPAGEREFS;
+	for (i=0; i<INUSE_WORDS; i++) {
+		prp->inuse[i] = 0;
+	}
+	prp->next = pagerefpages;
+	pagerefpages = prp;
+	npagerefpages++;
+}
 
 static
 struct pageref *
 allocpageref(void)
 {
+	struct pagerefpage *prp;
 	unsigned i,j;
 	uint32_t k;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
+	for (prp = pagerefpages; prp != NULL; prp = prp->next) {
+		if (prp->nfree == 0) {
 			continue;
 		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
+		for (i=0; i<INUSE_WORDS; i++) {
+			if (prp->inuse[i]==0xffffffff) {
+				/* full */
+				continue;
+			}
+			for (k=1,j=0; k!=0; k<<=1,j++) {
+				if ((prp->inuse[i] & k)==0) {
+					KASSERT(i*32 + j < NPAGEREFS);
+					prp->inuse[i] |= k;
+					prp->nfree--;
+					return &PRP_REFS(prp)[i*32 + j];
+				}
 			}
 		}
 		KASSERT(0);
@@ -170,15 +231,18 @@ static
 void
 freepageref(struct pageref *p)
 {
+	struct pagerefpage *prp;
 	size_t i, j;
 	uint32_t k;
 
-	j = p-pagerefs;
+	prp = (struct pagerefpage *)((vaddr_t)p & PAGE_FRAME);
+	j = p-PRP_REFS(prp);
 	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
 	i = j/32;
 	k = ((uint32_t)1) << (j%32);
-	KASSERT((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	KASSERT((prp->inuse[i] & k) != 0);
+	prp->inuse[i] &= ~k;
+	prp->nfree++;
 }
 
 ////////////////////////////////////////
@@ -186,6 +250,16 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/*
+ * Once the coremap is up, every page we carve into blocks is tagged
+ * there with its pageref (see kheap_bootstrap), so that kfree can find
+ * it in constant time and without the spinlock. Until then it has to
+ * search allbase.
+ */
+static bool kheap_tagged;
+
+#define KV_PADDR(va) ((va) - MIPS_KSEG0)
+
 ////////////////////////////////////////
 
 /*
@@ -197,6 +271,33 @@ static struct pageref *allbase;
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * ...except for this: each CPU keeps a magazine of free blocks of each
+ * size, which it can allocate from without taking the spinlock. An
+ * empty magazine is refilled, and a full one half emptied, in one go
+ * under the spinlock. A magazine holds at most a page (or slab) worth
+ * of blocks so that not too much memory sits idle in them.
+ *
+ * Magazines are only touched with interrupts off, which keeps us on
+ * the CPU they belong to.
+ */
+
+#define KMAG_SIZE 16
+
+struct kmag {
+	unsigned km_n;			/* blocks held */
+	void *km_objs[KMAG_SIZE];	/* the blocks, last in first out */
+	unsigned km_nalloc;		/* kmallocs of this size */
+	uint64_t km_waste;		/* bytes asked for short of the size */
+};
+
+static struct kmag kmags[MAXCPUS][NSIZES];
+
+#define KMAG_MAX(blktype) \
+	(SLAB_SIZE(blktype) / sizes[blktype] < KMAG_SIZE ? \
+	 SLAB_SIZE(blktype) / sizes[blktype] : KMAG_SIZE)
+#define KMAG_BATCH(blktype) ((KMAG_MAX(blktype) + 1) / 2)
+
 ////////////////////////////////////////
 
 /* SLOWER implies SLOW */
@@ -226,7 +327,7 @@ checksubpage(struct pageref *pr)
 	prpage = PR_PAGEADDR(pr);
 	blktype = PR_BLOCKTYPE(pr);
 
-	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	KASSERT(pr->freelist_offset < PR_SLABSIZE(pr));
 	KASSERT(pr->freelist_offset % sizes[blktype] == 0);
 
 	fla = prpage + pr->freelist_offset;
@@ -234,7 +335,7 @@ checksubpage(struct pageref *pr)
 
 	for (; fl != NULL; fl = fl->next) {
 		fla = (vaddr_t)fl;
-		KASSERT(fla >= prpage && fla < prpage + PAGE_SIZE);
+		KASSERT(fla >= prpage && fla < prpage + PR_SLABSIZE(pr));
 		KASSERT((fla-prpage) % sizes[blktype] == 0);
 		KASSERT(fla >= MIPS_KSEG0);
 		KASSERT(fla < MIPS_KSEG1);
@@ -260,14 +361,14 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
+			KASSERT(sc < npagerefpages * NPAGEREFS);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
+		KASSERT(ac < npagerefpages * NPAGEREFS);
 		ac++;
 	}
 
@@ -301,7 +402,7 @@ dumpsubpage(struct pageref *pr)
 	blktype = PR_BLOCKTYPE(pr);
 
 	/* compute how many bits we need in freemap and assert we fit */
-	n = PAGE_SIZE / sizes[blktype];
+	n = SLAB_SIZE(blktype) / sizes[blktype];
 	KASSERT(n <= 32*sizeof(freemap)/sizeof(freemap[0]));
 
 	if (pr->freelist_offset != INVALID_OFFSET) {
@@ -334,11 +435,40 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i, j, cached, nalloc, nslabs;
+	uint64_t waste;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
-	kprintf("Subpage allocator status:\n");
+	kprintf("Subpage allocator status: %u page(s) of pagerefs\n",
+		npagerefpages);
+
+	/*
+	 * Per size: the slabs in use and what they lose at their ends,
+	 * then how many kmallocs there have been and how many bytes
+	 * they asked for less than the size. Blocks in magazines show
+	 * up below as allocated.
+	 */
+	kprintf("size  pages  slabs  tail waste  kmallocs  waste (KB)"
+		"  in magazines\n");
+	for (i=0; i<NSIZES; i++) {
+		nslabs = 0;
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			nslabs++;
+		}
+		cached = nalloc = 0;
+		waste = 0;
+		for (j=0; j<MAXCPUS; j++) {
+			cached += kmags[j][i].km_n;
+			nalloc += kmags[j][i].km_nalloc;
+			waste += kmags[j][i].km_waste;
+		}
+		kprintf("%4lu  %5u  %5u  %10lu  %8u  %10lu  %12u\n",
+			(unsigned long) sizes[i], slabpages[i], nslabs,
+			(unsigned long) nslabs * (SLAB_SIZE(i) % sizes[i]),
+			nalloc, (unsigned long)(waste >> 10), cached);
+	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		dumpsubpage(pr);
@@ -392,6 +522,215 @@ int blocktype(size_t sz)
 	return 0;
 }
 
+/*
+ * Take the first free block off page PR, which must have one.
+ */
+static
+void *
+subpage_pop(struct pageref *pr)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PR_SLABSIZE(pr));
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PR_SLABSIZE(pr));
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+
+	return retptr;
+}
+
+/*
+ * Put block PTR back on page PR. If that makes the whole page (or
+ * slab) free, take it off our lists and return its address, for the
+ * caller to free once it has let go of the spinlock; otherwise return 0.
+ */
+static
+vaddr_t
+subpage_push(struct pageref *pr, void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = (vaddr_t)ptr - prpage;
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fla = prpage + offset;
+	fl = (struct freelist *)fla;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= SLAB_SIZE(blktype) / sizes[blktype]);
+	if (pr->nfree == SLAB_SIZE(blktype) / sizes[blktype]) {
+		/* Whole page is free; untag it, as it may be a slab. */
+		if (kheap_tagged) {
+			coremap_settag(KV_PADDR(prpage), NULL);
+		}
+		remove_lists(pr, blktype);
+		freepageref(pr);
+		return prpage;
+	}
+	return 0;
+}
+
+/*
+ * Find the page PTRADDR was allocated from, or NULL if it is not one
+ * of ours. Before kheap_bootstrap this searches, and the caller must
+ * hold the spinlock.
+ */
+static
+struct pageref *
+subpage_lookup(vaddr_t ptraddr)
+{
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	int blktype;		// index into sizes[] that we're using
+
+	if (kheap_tagged) {
+		return coremap_gettag(KV_PADDR(ptraddr & PAGE_FRAME));
+	}
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	for (pr = allbase; pr; pr = pr->next_all) {
+		prpage = PR_PAGEADDR(pr);
+		blktype = PR_BLOCKTYPE(pr);
+
+		/* check for corruption */
+		KASSERT(blktype>=0 && blktype<NSIZES);
+		checksubpage(pr);
+
+		if (ptraddr >= prpage && ptraddr < prpage + SLAB_SIZE(blktype)) {
+			break;
+		}
+	}
+	return pr;
+}
+
+/*
+ * Get a block of size class BLKTYPE from this CPU's magazine, first
+ * refilling it from pages we already have if it is empty. Returns
+ * NULL if there are no free blocks of that size anywhere. WASTE is how
+ * much of the block the caller will not use, for kheap_printstats.
+ */
+static
+void *
+kmag_get(unsigned blktype, size_t waste)
+{
+	struct kmag *mag;
+	struct pageref *pr;
+	void *ptr = NULL;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* too early in boot for per-cpu anything */
+		return NULL;
+	}
+
+	spl = splhigh();
+	mag = &kmags[curcpu->c_number][blktype];
+	mag->km_nalloc++;
+	mag->km_waste += waste;
+	if (mag->km_n == 0) {
+		spinlock_acquire(&kmalloc_spinlock);
+		pr = sizebases[blktype];
+		while (pr != NULL && mag->km_n < KMAG_BATCH(blktype)) {
+			if (pr->nfree == 0) {
+				pr = pr->next_samesize;
+				continue;
+			}
+			mag->km_objs[mag->km_n++] = subpage_pop(pr);
+		}
+		checksubpages();
+		spinlock_release(&kmalloc_spinlock);
+	}
+	if (mag->km_n > 0) {
+		ptr = mag->km_objs[--mag->km_n];
+	}
+	splx(spl);
+	return ptr;
+}
+
+/*
+ * Put PTR, from page PR, in this CPU's magazine, first giving half of
+ * it back to the pages if it is full. Pages that become entirely free
+ * are returned in PAGES (at most KMAG_SIZE/2 of them), for the caller
+ * to free; returns how many.
+ */
+static
+unsigned
+kmag_put(struct pageref *pr, void *ptr, vaddr_t *pages)
+{
+	struct kmag *mag;
+	unsigned blktype = PR_BLOCKTYPE(pr);
+	unsigned npages = 0;
+	vaddr_t page;
+	void *old;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		spinlock_acquire(&kmalloc_spinlock);
+		page = subpage_push(pr, ptr);
+		spinlock_release(&kmalloc_spinlock);
+		if (page != 0) {
+			pages[npages++] = page;
+		}
+		return npages;
+	}
+
+	spl = splhigh();
+	mag = &kmags[curcpu->c_number][blktype];
+	if (mag->km_n == KMAG_MAX(blktype)) {
+		spinlock_acquire(&kmalloc_spinlock);
+		while (mag->km_n > KMAG_MAX(blktype) - KMAG_BATCH(blktype)) {
+			old = mag->km_objs[--mag->km_n];
+			page = subpage_push(subpage_lookup((vaddr_t)old), old);
+			if (page != 0) {
+				pages[npages++] = page;
+			}
+		}
+		checksubpages();
+		spinlock_release(&kmalloc_spinlock);
+	}
+	mag->km_objs[mag->km_n++] = ptr;
+	splx(spl);
+	return npages;
+}
+
 static
 void *
 subpage_kmalloc(size_t sz)
@@ -399,6 +738,7 @@ subpage_kmalloc(size_t sz)
 	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t prrefs;		// new page of pagerefs, if needed
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
 	void *retptr;		// our result
@@ -407,7 +747,11 @@ subpage_kmalloc(size_t sz)
 
 
 	blktype = blocktype(sz);
-	sz = sizes[blktype];
+
+	retptr = kmag_get(blktype, sizes[blktype] - sz);
+	if (retptr != NULL) {
+		return retptr;
+	}
 
 	spinlock_acquire(&kmalloc_spinlock);
 
@@ -423,25 +767,7 @@ subpage_kmalloc(size_t sz)
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+			retptr = subpage_pop(pr);
 
 			checksubpages();
 
@@ -460,7 +786,7 @@ subpage_kmalloc(size_t sz)
 	 */
 
 	spinlock_release(&kmalloc_spinlock);
-	prpage = alloc_kpages(1);
+	prpage = alloc_kpages(slabpages[blktype]);
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
@@ -469,16 +795,30 @@ subpage_kmalloc(size_t sz)
 	spinlock_acquire(&kmalloc_spinlock);
 
 	pr = allocpageref();
-	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
+	while (pr==NULL) {
+		/*
+		 * Out of accounting space for the new page; get a
+		 * page of pagerefs, again without the spinlock. Some
+		 * other thread may have beaten us to it, in which case
+		 * the extra page is simply more room.
+		 */
 		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
-		return NULL;
+		prrefs = alloc_kpages(1);
+		if (prrefs==0) {
+			free_kpages(prpage);
+			kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
+			return NULL;
+		}
+		spinlock_acquire(&kmalloc_spinlock);
+		addpagerefpage(prrefs);
+		pr = allocpageref();
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
-	pr->nfree = PAGE_SIZE / sizes[blktype];
+	pr->nfree = SLAB_SIZE(blktype) / sizes[blktype];
+	if (kheap_tagged) {
+		coremap_settag(KV_PADDR(prpage), pr);
+	}
 
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
@@ -508,47 +848,25 @@ subpage_kmalloc(size_t sz)
 	goto doalloc;
 }
 
+/*
+ * Free PTR, which was allocated from page PR.
+ */
 static
-int
-subpage_kfree(void *ptr)
+void
+subpage_kfree(void *ptr, struct pageref *pr)
 {
 	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
-	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+	vaddr_t pages[KMAG_SIZE/2];	// pages to give back
+	unsigned i, npages;
 
-	ptraddr = (vaddr_t)ptr;
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
-
-	offset = ptraddr - prpage;
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = (vaddr_t)ptr - prpage;
 
 	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+	if (offset >= SLAB_SIZE(blktype) || offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
@@ -558,32 +876,11 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef(ptr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
+	npages = kmag_put(pr, ptr, pages);
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<npages; i++) {
+		free_kpages(pages[i]);
 	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
@@ -591,17 +888,42 @@ subpage_kfree(void *ptr)
 	checksubpages();
 	spinlock_release(&kmalloc_spinlock);
 #endif
+}
 
-	return 0;
+/*
+ * Called by coremap_bootstrap: tag the pages we got before there was
+ * a coremap, and from now on tag new ones as we get them.
+ */
+void
+kheap_bootstrap(void)
+{
+	struct pageref *pr;
+	unsigned i;
+
+#if OPT_KHPROF
+	khprof_bootstrap();
+#endif
+
+	/* Stolen slabs are separate frames, so tag each page */
+	spinlock_acquire(&kmalloc_spinlock);
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		for (i=0; i<slabpages[PR_BLOCKTYPE(pr)]; i++) {
+			coremap_settag(KV_PADDR(PR_PAGEADDR(pr)) +
+				       i * PAGE_SIZE, pr);
+		}
+	}
+	kheap_tagged = true;
+	spinlock_release(&kmalloc_spinlock);
 }
 
 //
 ////////////////////////////////////////////////////////////
 
+static
 void *
-kmalloc(size_t sz)
+kmalloc_unprofiled(size_t sz)
 {
-	if (sz>=LARGEST_SUBPAGE_SIZE) {
+	if (sz>LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
 
@@ -618,17 +940,368 @@ kmalloc(size_t sz)
 	return subpage_kmalloc(sz);
 }
 
+static
 void
-kfree(void *ptr)
+kfree_unprofiled(void *ptr)
 {
+	struct pageref *pr;
+
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Find the page it is on; if that is not one of ours it must
+	 * be a big allocation.
 	 */
-	if (ptr == NULL) {
-		return;
-	} else if (subpage_kfree(ptr)) {
+	if (kheap_tagged) {
+		pr = subpage_lookup((vaddr_t)ptr);
+	}
+	else {
+		spinlock_acquire(&kmalloc_spinlock);
+		pr = subpage_lookup((vaddr_t)ptr);
+		spinlock_release(&kmalloc_spinlock);
+	}
+
+	if (pr != NULL) {
+		subpage_kfree(ptr, pr);
+	}
+	else {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
 }
 
+
+#if OPT_KHPROF
+
+////////////////////////////////////////////////////////////
+//
+// Allocation profiling.
+//
+// With "options khprof" every block carries an 8-byte header saying
+// which call site asked for it and how big it was, and each call site
+// (return address of the kmalloc call) gets a slot in a hash table.
+//
+// A header would push a block of KHPROF_OOB bytes or more into the
+// next size or an extra page, so those keep it out of band instead,
+// in khprof_oob[]: one entry for each KHPROF_OOB bytes of RAM, which
+// is enough, as such blocks all start on a KHPROF_OOB boundary. A
+// pointer after a header never does (blocks are multiples of 16
+// bytes), which is how kfree tells the two apart. The table is made
+// by kheap_bootstrap; until then every block gets a header.
+// The counts per slot are per-CPU and only touched with interrupts
+// off, so the only lock is the one taken the first time a call site
+// is seen. Blocks are freed back to the counters of the CPU doing the
+// kfree, so the counts on any one CPU can go negative; only the sums
+// mean anything.
+//
+// Call sites are printed as addresses; look them up with addr2line
+// on the kernel binary. Allocations made through kstrdup show up as
+// kstrdup, and the same goes for the object caches.
+//
+
+#define KHPROF_SITES 256	/* hash table size; a power of two */
+#define KHPROF_OTHER 0		/* slot for sites that did not fit */
+#define KHPROF_TOP   12		/* lines printed in each list */
+
+struct khprof_hdr {
+	uint16_t kh_site;	/* call site slot */
+	uint16_t kh_pad;
+	uint32_t kh_size;	/* size asked for */
+};
+
+/* Out-of-band entries: site in the top 8 bits, size below */
+#define KHPROF_OOB 1024
+#define OOB_MAKE(site, sz) (((uint32_t)(site) << 24) | (sz))
+#define OOB_SITE(e)  ((e) >> 24)
+#define OOB_SIZE(e)  ((e) & 0xffffff)
+
+static uint32_t *khprof_oob;
+
+struct khprof_count {
+	unsigned kc_nalloc;
+	unsigned kc_nfree;
+	int kc_bytes;		/* live bytes */
+};
+
+/* Written once each, under the lock; zero means unused */
+static vaddr_t khprof_callers[KHPROF_SITES];
+static struct khprof_count khprof_counts[MAXCPUS][KHPROF_SITES];
+static struct spinlock khprof_lock = SPINLOCK_INITIALIZER;
+
+/* For the allocation rates: the counts when khprof last ran */
+static unsigned khprof_lastnalloc[KHPROF_SITES];
+static time_t khprof_lastsecs;
+static uint32_t khprof_lastnsecs;
+static bool khprof_ran;
+
+/*
+ * Find (or make) the slot for CALLER. Looking is done without the
+ * lock: a slot's caller, once set, never changes.
+ */
+static
+unsigned
+khprof_site(vaddr_t caller)
+{
+	unsigned i, n, start;
+
+	start = 1 + (caller >> 2) % (KHPROF_SITES - 1);
+	for (i = start, n = 0; n < KHPROF_SITES - 1; n++) {
+		if (khprof_callers[i] == caller) {
+			return i;
+		}
+		if (khprof_callers[i] == 0) {
+			break;
+		}
+		i = (i == KHPROF_SITES - 1) ? 1 : i + 1;
+	}
+
+	/* Not there; look again with the lock, and add it */
+	spinlock_acquire(&khprof_lock);
+	for (i = start, n = 0; n < KHPROF_SITES - 1; n++) {
+		if (khprof_callers[i] == caller) {
+			break;
+		}
+		if (khprof_callers[i] == 0) {
+			khprof_callers[i] = caller;
+			break;
+		}
+		i = (i == KHPROF_SITES - 1) ? 1 : i + 1;
+	}
+	spinlock_release(&khprof_lock);
+	return n < KHPROF_SITES - 1 ? i : KHPROF_OTHER;
+}
+
+static
+void
+khprof_count(unsigned site, bool alloc, size_t sz)
+{
+	struct khprof_count *kc;
+	int spl;
+
+	/* Before curcpu there is only the boot CPU */
+	spl = splhigh();
+	kc = &khprof_counts[CURCPU_EXISTS() ? curcpu->c_number : 0][site];
+	if (alloc) {
+		kc->kc_nalloc++;
+		kc->kc_bytes += sz;
+	}
+	else {
+		kc->kc_nfree++;
+		kc->kc_bytes -= sz;
+	}
+	splx(spl);
+}
+
+static
+void
+khprof_bootstrap(void)
+{
+	unsigned npages;
+
+	COMPILE_ASSERT(KHPROF_SITES <= 256);
+
+	npages = DIVROUNDUP(mainbus_ramsize() / KHPROF_OOB * sizeof(uint32_t),
+			    PAGE_SIZE);
+	khprof_oob = (uint32_t *)alloc_kpages(npages);
+	if (khprof_oob == NULL) {
+		kprintf("khprof: no memory for the table of large blocks\n");
+	}
+}
+
+void *
+kmalloc(size_t sz)
+{
+	struct khprof_hdr *kh;
+	unsigned site;
+	void *ptr;
+
+	site = khprof_site((vaddr_t)__builtin_return_address(0));
+
+	if (khprof_oob != NULL && sz + sizeof(*kh) > KHPROF_OOB) {
+		KASSERT(sz <= OOB_SIZE(0xffffffff));
+		ptr = kmalloc_unprofiled(sz);
+		if (ptr == NULL) {
+			return NULL;
+		}
+		KASSERT((vaddr_t)ptr % KHPROF_OOB == 0);
+		khprof_oob[KV_PADDR((vaddr_t)ptr) / KHPROF_OOB] =
+			OOB_MAKE(site, sz);
+	}
+	else {
+		kh = kmalloc_unprofiled(sz + sizeof(*kh));
+		if (kh == NULL) {
+			return NULL;
+		}
+		kh->kh_site = site;
+		kh->kh_size = sz;
+		ptr = kh + 1;
+	}
+	khprof_count(site, true, sz);
+	return ptr;
+}
+
+void
+kfree(void *ptr)
+{
+	struct khprof_hdr *kh;
+	uint32_t e;
+
+	if (ptr == NULL) {
+		return;
+	}
+	if ((vaddr_t)ptr % KHPROF_OOB == 0) {
+		KASSERT(khprof_oob != NULL);
+		e = khprof_oob[KV_PADDR((vaddr_t)ptr) / KHPROF_OOB];
+		khprof_count(OOB_SITE(e), false, OOB_SIZE(e));
+		kfree_unprofiled(ptr);
+		return;
+	}
+	kh = (struct khprof_hdr *)ptr - 1;
+	KASSERT(kh->kh_site < KHPROF_SITES);
+	khprof_count(kh->kh_site, false, kh->kh_size);
+	kfree_unprofiled(kh);
+}
+
+struct khprof_line {
+	vaddr_t kl_caller;
+	unsigned kl_live;	/* blocks */
+	int kl_bytes;
+	unsigned kl_nalloc;
+	unsigned kl_rate;	/* kmallocs per second since the last run */
+	bool kl_printed;
+};
+
+/*
+ * Print the KHPROF_TOP lines with the most live bytes, or the highest
+ * allocation rate if BYRATE, biggest first.
+ */
+static
+void
+khprof_printtop(struct khprof_line *lines, unsigned n, bool byrate)
+{
+	unsigned i, j, best;
+	unsigned key, bestkey;
+
+	for (j = 0; j < n; j++) {
+		lines[j].kl_printed = false;
+	}
+
+	kprintf("caller        live blocks  live bytes    kmallocs  per sec\n");
+	for (i = 0; i < KHPROF_TOP; i++) {
+		best = n;
+		bestkey = 0;
+		for (j = 0; j < n; j++) {
+			if (lines[j].kl_printed) {
+				continue;
+			}
+			key = byrate ? lines[j].kl_rate :
+				(lines[j].kl_bytes > 0 ?
+				 (unsigned)lines[j].kl_bytes : 0);
+			if (key > bestkey) {
+				best = j;
+				bestkey = key;
+			}
+		}
+		if (best == n) {
+			break;
+		}
+		if (lines[best].kl_caller == 0) {
+			kprintf("(other)   ");
+		}
+		else {
+			kprintf("0x%08lx", (unsigned long)lines[best].kl_caller);
+		}
+		kprintf("  %11u  %10d  %10u  %7u\n",
+			lines[best].kl_live, lines[best].kl_bytes,
+			lines[best].kl_nalloc, lines[best].kl_rate);
+		lines[best].kl_printed = true;
+	}
+}
+
+/*
+ * Print the call sites holding the most memory, and the ones
+ * allocating the fastest since the last time. Not for use by more
+ * than one thread at a time.
+ */
+void
+kheap_printprofile(void)
+{
+	struct khprof_line *lines;
+	time_t secs, nowsecs;
+	uint32_t nsecs, nownsecs;
+	unsigned i, j, n, ms, nalloc, nfree, delta;
+	int bytes;
+
+	lines = kmalloc_unprofiled(KHPROF_SITES * sizeof(*lines));
+	if (lines == NULL) {
+		kprintf("khprof: out of memory\n");
+		return;
+	}
+
+	gettime(&nowsecs, &nownsecs);
+	ms = 0;
+	if (khprof_ran) {
+		getinterval(khprof_lastsecs, khprof_lastnsecs,
+			    nowsecs, nownsecs, &secs, &nsecs);
+		ms = secs * 1000 + nsecs / 1000000;
+	}
+
+	n = 0;
+	for (i = 0; i < KHPROF_SITES; i++) {
+		if (i != KHPROF_OTHER && khprof_callers[i] == 0) {
+			continue;
+		}
+		nalloc = nfree = 0;
+		bytes = 0;
+		for (j = 0; j < MAXCPUS; j++) {
+			nalloc += khprof_counts[j][i].kc_nalloc;
+			nfree += khprof_counts[j][i].kc_nfree;
+			bytes += khprof_counts[j][i].kc_bytes;
+		}
+		if (nalloc == 0) {
+			continue;
+		}
+		lines[n].kl_caller = khprof_callers[i];
+		lines[n].kl_live = nalloc - nfree;
+		lines[n].kl_bytes = bytes;
+		lines[n].kl_nalloc = nalloc;
+		delta = nalloc - khprof_lastnalloc[i];
+		lines[n].kl_rate = ms > 0 ?
+			delta / ms * 1000 + delta % ms * 1000 / ms : 0;
+		khprof_lastnalloc[i] = nalloc;
+		n++;
+	}
+	khprof_lastsecs = nowsecs;
+	khprof_lastnsecs = nownsecs;
+
+	kprintf("kmalloc profile: %u call sites\n", n);
+	kprintf("Holding the most memory:\n");
+	khprof_printtop(lines, n, false);
+	if (khprof_ran) {
+		kprintf("Allocating the fastest, over the last %u ms:\n", ms);
+		khprof_printtop(lines, n, true);
+	}
+	else {
+		kprintf("Run khprof again for allocation rates.\n");
+	}
+	khprof_ran = true;
+
+	kfree_unprofiled(lines);
+}
+
+#else /* !OPT_KHPROF */
+
+void *
+kmalloc(size_t sz)
+{
+	return kmalloc_unprofiled(sz);
+}
+
+void
+kfree(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	kfree_unprofiled(ptr);
+}
+
+#endif /* OPT_KHPROF */
@@ -0,0 +1,120 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmem_cache.h>
+
+/*
+ * Each object is preceded by a small header that links it on the free
+ * list while it is in the cache, so that caching it does not disturb
+ * the object itself. The header is 8 bytes to keep the object aligned
+ * as kmalloc would.
+ */
+struct kmem_obj {
+	struct kmem_obj *ko_next;
+	uint32_t ko_pad;
+};
+
+#define KO_OBJ(ko)  ((void *)((ko) + 1))
+#define KO_HDR(obj) ((struct kmem_obj *)(obj) - 1)
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_free = NULL;
+	kc->kc_nfree = 0;
+	kc->kc_nalloc = 0;
+	return kc;
+}
+
+/*
+ * Run the destructor on the object with header KO and free it.
+ */
+static
+void
+kmem_obj_destroy(struct kmem_cache *kc, struct kmem_obj *ko)
+{
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(KO_OBJ(ko));
+	}
+	kfree(ko);
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_obj *ko;
+
+	KASSERT(kc->kc_nalloc == 0);
+	while ((ko = kc->kc_free) != NULL) {
+		kc->kc_free = ko->ko_next;
+		kmem_obj_destroy(kc, ko);
+	}
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_obj *ko;
+
+	spinlock_acquire(&kc->kc_lock);
+	ko = kc->kc_free;
+	if (ko != NULL) {
+		kc->kc_free = ko->ko_next;
+		kc->kc_nfree--;
+	}
+	kc->kc_nalloc++;
+	spinlock_release(&kc->kc_lock);
+
+	if (ko == NULL) {
+		/* Make a new one, without the spinlock */
+		ko = kmalloc(sizeof(*ko) + kc->kc_size);
+		if (ko != NULL && kc->kc_ctor != NULL &&
+		    kc->kc_ctor(KO_OBJ(ko)) != 0) {
+			kfree(ko);
+			ko = NULL;
+		}
+		if (ko == NULL) {
+			spinlock_acquire(&kc->kc_lock);
+			kc->kc_nalloc--;
+			spinlock_release(&kc->kc_lock);
+			return NULL;
+		}
+	}
+	return KO_OBJ(ko);
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_obj *ko = KO_HDR(obj);
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(kc->kc_nalloc > 0);
+	kc->kc_nalloc--;
+	if (kc->kc_nfree < KC_LIMIT) {
+		ko->ko_next = kc->kc_free;
+		kc->kc_free = ko;
+		kc->kc_nfree++;
+		ko = NULL;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (ko != NULL) {
+		/* Cache is full; destroy it, without the spinlock */
+		kmem_obj_destroy(kc, ko);
+	}
+}
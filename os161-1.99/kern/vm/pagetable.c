@@ -0,0 +1,85 @@
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <zeropool.h>
+
+/*
+ * Page table management for the paged VM system. See pagetable.h.
+ */
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < PT_L1_ENTRIES; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	for (i = 0; i < PT_L1_ENTRIES; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			free_kpages((vaddr_t)pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+/*
+ * A second-level table is exactly one page, so new ones come from the
+ * zeroed pool when it has any.
+ */
+static
+pte_t *
+pt_newl2(void)
+{
+	paddr_t paddr;
+	vaddr_t kva;
+
+	paddr = zeropool_get();
+	if (paddr != 0) {
+		return (pte_t *)PADDR_TO_KVADDR(paddr);
+	}
+	kva = alloc_kpages(1);
+	if (kva == 0) {
+		return NULL;
+	}
+	bzero((void *)kva, PAGE_SIZE);
+	return (pte_t *)kva;
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	unsigned l1 = PT_L1_INDEX(vaddr);
+	pte_t *l2;
+
+	if (vaddr >= USERSPACETOP) {
+		return NULL;
+	}
+
+	l2 = pt->pt_dir[l1];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = pt_newl2();
+		if (l2 == NULL) {
+			return NULL;
+		}
+		pt->pt_dir[l1] = l2;
+	}
+	return &l2[PT_L2_INDEX(vaddr)];
+}
@@ -0,0 +1,180 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <stat.h>
+#include <uio.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+/*
+ * Swap space on a raw disk. Slot N lives at byte offset N * PAGE_SIZE
+ * of the device. Each slot belongs to exactly one page table entry, so
+ * I/O on a slot needs no locking; only the bitmap does.
+ */
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;
+static unsigned swap_nslots;
+static unsigned swap_nused;
+
+/* Protects swap_map and swap_nused */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	char path[] = SWAP_DEVICE;
+	struct stat st;
+	int result;
+
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: cannot open %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: cannot stat %s: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: out of memory for slot bitmap\n");
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	KASSERT(swap_enabled());
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		swap_nused++;
+	}
+	spinlock_release(&swap_lock);
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_nused--;
+	spinlock_release(&swap_lock);
+}
+
+unsigned
+swap_used(void)
+{
+	return swap_nused;
+}
+
+/*
+ * Move one page between BUF and slot SLOT.
+ */
+static
+int
+swap_io(unsigned slot, void *buf, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, buf, PAGE_SIZE, (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		kprintf("swap: short %s on slot %u\n",
+			rw == UIO_READ ? "read" : "write", slot);
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_in(unsigned slot, paddr_t paddr)
+{
+	int result;
+
+	result = swap_io(slot, (void *)PADDR_TO_KVADDR(paddr), UIO_READ);
+	if (result == 0) {
+		vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	}
+	return result;
+}
+
+int
+swap_out(unsigned slot, paddr_t paddr)
+{
+	int result;
+
+	result = swap_io(slot, (void *)PADDR_TO_KVADDR(paddr), UIO_WRITE);
+	if (result == 0) {
+		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	}
+	return result;
+}
+
+int
+swap_copy(unsigned slot, unsigned *newslot)
+{
+	void *buf;
+	int result;
+
+	buf = kmalloc(PAGE_SIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	result = swap_alloc(newslot);
+	if (result) {
+		kfree(buf);
+		return result;
+	}
+
+	result = swap_io(slot, buf, UIO_READ);
+	if (result == 0) {
+		result = swap_io(*newslot, buf, UIO_WRITE);
+	}
+	if (result) {
+		swap_free(*newslot);
+	}
+	kfree(buf);
+	return result;
+}
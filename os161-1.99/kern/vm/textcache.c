@@ -0,0 +1,122 @@
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <textcache.h>
+#include <uw-vmstats.h>
+
+/*
+ * The cache is a hash table of singly linked chains. Lookups hash the
+ * vnode and offset; textcache_reclaim walks the buckets round-robin
+ * so that repeated calls spread over the whole table.
+ */
+
+#define TC_BUCKETS 256
+
+struct tcpage {
+	struct vnode *tc_vnode;
+	off_t tc_offset;
+	size_t tc_skip;
+	size_t tc_len;
+	paddr_t tc_paddr;
+	struct tcpage *tc_next;
+};
+
+static struct tcpage **tc_table;
+static unsigned tc_hand;
+
+static
+unsigned
+tc_hash(struct vnode *v, off_t offset)
+{
+	return ((uintptr_t)v / sizeof(void *) +
+		((uint32_t)offset >> PT_L2_SHIFT)) % TC_BUCKETS;
+}
+
+void
+textcache_bootstrap(void)
+{
+	unsigned i;
+
+	tc_table = kmalloc(TC_BUCKETS * sizeof(struct tcpage *));
+	if (tc_table == NULL) {
+		panic("textcache_bootstrap: out of memory\n");
+	}
+	for (i = 0; i < TC_BUCKETS; i++) {
+		tc_table[i] = NULL;
+	}
+	tc_hand = 0;
+}
+
+paddr_t
+textcache_lookup(struct vnode *v, off_t offset, size_t skip, size_t len)
+{
+	struct tcpage *tc;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	for (tc = tc_table[tc_hash(v, offset)]; tc != NULL; tc = tc->tc_next) {
+		if (tc->tc_vnode == v && tc->tc_offset == offset &&
+		    tc->tc_skip == skip && tc->tc_len == len) {
+			coremap_incref(tc->tc_paddr);
+			return tc->tc_paddr;
+		}
+	}
+	return 0;
+}
+
+void
+textcache_insert(struct vnode *v, off_t offset, size_t skip, size_t len,
+		 paddr_t paddr)
+{
+	struct tcpage *tc;
+	unsigned h;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	tc = kmalloc(sizeof(struct tcpage));
+	if (tc == NULL) {
+		/* The page just stays private */
+		return;
+	}
+	VOP_INCREF(v);
+	coremap_incref(paddr);
+
+	h = tc_hash(v, offset);
+	tc->tc_vnode = v;
+	tc->tc_offset = offset;
+	tc->tc_skip = skip;
+	tc->tc_len = len;
+	tc->tc_paddr = paddr;
+	tc->tc_next = tc_table[h];
+	tc_table[h] = tc;
+	vmstats_inc(VMSTAT_TEXT_CACHED);
+}
+
+bool
+textcache_reclaim(void)
+{
+	struct tcpage *tc, **prev;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	for (i = 0; i < TC_BUCKETS; i++) {
+		prev = &tc_table[tc_hand];
+		tc_hand = (tc_hand + 1) % TC_BUCKETS;
+		for (tc = *prev; tc != NULL; prev = &tc->tc_next, tc = *prev) {
+			if (coremap_refcount(tc->tc_paddr) > 1) {
+				continue;
+			}
+			*prev = tc->tc_next;
+			freeppages(tc->tc_paddr);
+			VOP_DECREF(tc->tc_vnode);
+			kfree(tc);
+			return true;
+		}
+	}
+	return false;
+}
@@ -5,7 +5,8 @@
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions whose names begin with '_'
  * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * (i.e., outside of these routines) by acquiring stats_lock,
+ * or for _vmstats_inc by having interrupts off.
  * All of the functions whose names do not begin
  * with '_' ensure atomicity locally.
  */
@@ -14,10 +15,18 @@
 #include <lib.h>
 #include <synch.h>
 #include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <proc.h>
+#include <platform/maxcpus.h>
 #include <uw-vmstats.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
+/*
+ * Counters for tracking statistics, one row per CPU so that counting
+ * an event never contends with another CPU. Readers add up the rows.
+ */
+static unsigned int stats_counts[MAXCPUS][VMSTAT_COUNT];
 
 struct spinlock stats_lock = SPINLOCK_INITIALIZER;
 
@@ -33,6 +42,14 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "Address Space Switches",
+ /* 11 */ "Page Faults (Shared)",
+ /* 12 */ "Text Pages Cached",
+ /* 13 */ "TLB Fault-around Entries",
+ /* 14 */ "TLB Fault-around Misses",
+ /* 15 */ "Zeroed Pool Hits",
+ /* 16 */ "Zeroed Pool Misses",
+ /* 17 */ "Page Faults from mmap",
 };
 
 
@@ -41,9 +58,11 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
+    int spl;
+
+    spl = splhigh();
       _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+    splx(spl);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -61,11 +80,41 @@ vmstats_init(void)
 }
 
 /* ---------------------------------------------------------------------- */
+/*
+ * Interrupts must be off so that we stay on this CPU. The event is
+ * also charged to the current user process, if any; only its own
+ * thread ever writes its counters, so they need no lock either.
+ */
 void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  KASSERT(curcpu->c_number < MAXCPUS);
+  stats_counts[curcpu->c_number][index]++;
+
+  if (!curthread->t_in_interrupt && curproc != NULL && curproc != kproc) {
+    curproc->p_vmstats[index]++;
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+/*
+ * Totals over all CPUs. Rows may move on while we add them up, so the
+ * result is only a snapshot.
+ */
+void
+vmstats_get(unsigned int counts[VMSTAT_COUNT])
+{
+  unsigned i, j;
+
+  for (j=0; j<VMSTAT_COUNT; j++) {
+    counts[j] = 0;
+  }
+  for (i=0; i<MAXCPUS; i++) {
+    for (j=0; j<VMSTAT_COUNT; j++) {
+      counts[j] += stats_counts[i][j];
+    }
+  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -73,6 +122,7 @@ void
 _vmstats_init(void)
 {
   int i = 0;
+  int j = 0;
 
   if (sizeof(stats_names) / sizeof(char *) != VMSTAT_COUNT) {
     kprintf("vmstats_init: number of stats_names = %d != VMSTAT_COUNT = %d\n",
@@ -80,8 +130,10 @@ _vmstats_init(void)
     panic("Should really fix this before proceeding\n");
   }
 
-  for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+  for (i=0; i<MAXCPUS; i++) {
+    for (j=0; j<VMSTAT_COUNT; j++) {
+      stats_counts[i][j] = 0;
+    }
   }
 
 }
@@ -100,20 +152,31 @@ vmstats_print(void)
   int free_plus_replace = 0;
   int disk_plus_zeroed_plus_reload = 0;
   int tlb_faults = 0;
-  int elf_plus_swap_reads = 0;
+  int file_plus_swap_reads = 0;
   int disk_reads = 0;
+  int switches = 0;
+  int cached = 0;
+  int shared = 0;
+  int around = 0;
+  int kept = 0;
+  unsigned int counts[VMSTAT_COUNT];
+
+  vmstats_get(counts);
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
-    kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_counts[i]);
+    kprintf("VMSTAT %25s = %10d\n", stats_names[i], counts[i]);
   }
 
-  tlb_faults = stats_counts[VMSTAT_TLB_FAULT];
-  free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
-  disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
-    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
-  disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
+  tlb_faults = counts[VMSTAT_TLB_FAULT];
+  free_plus_replace = counts[VMSTAT_TLB_FAULT_FREE] + counts[VMSTAT_TLB_FAULT_REPLACE];
+  /* faults on a page already in the text cache need neither disk nor zeroing */
+  disk_plus_zeroed_plus_reload = counts[VMSTAT_PAGE_FAULT_DISK] +
+    counts[VMSTAT_PAGE_FAULT_ZERO] + counts[VMSTAT_TLB_RELOAD] +
+    counts[VMSTAT_PAGE_FAULT_SHARED];
+  file_plus_swap_reads = counts[VMSTAT_ELF_FILE_READ] +
+    counts[VMSTAT_MMAP_FILE_READ] + counts[VMSTAT_SWAP_FILE_READ];
+  disk_reads = counts[VMSTAT_PAGE_FAULT_DISK];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
   if (tlb_faults != free_plus_replace) {
@@ -121,17 +184,41 @@ vmstats_print(void)
       tlb_faults, free_plus_replace); 
   }
 
-  kprintf("VMSTAT TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) = %d\n",
+  kprintf("VMSTAT TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) + Page Faults (Shared) = %d\n",
     disk_plus_zeroed_plus_reload);
   if (tlb_faults != disk_plus_zeroed_plus_reload) {
-    kprintf("WARNING: TLB Faults (%d) != TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) (%d)\n",
+    kprintf("WARNING: TLB Faults (%d) != TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) + Page Faults (Shared) (%d)\n",
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
-  kprintf("VMSTAT ELF File reads + Swapfile reads = %d\n", elf_plus_swap_reads);
-  if (disk_reads != elf_plus_swap_reads) {
-    kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
-      elf_plus_swap_reads);
+  kprintf("VMSTAT ELF File reads + mmap reads + Swapfile reads = %d\n",
+    file_plus_swap_reads);
+  if (disk_reads != file_plus_swap_reads) {
+    kprintf("WARNING: ELF File reads + mmap reads + Swapfile reads != Page Faults (Disk) %d\n",
+      file_plus_swap_reads);
+  }
+
+  /* How many processes each cached text page ended up shared by, on average */
+  cached = counts[VMSTAT_TEXT_CACHED];
+  if (cached > 0) {
+    shared = counts[VMSTAT_PAGE_FAULT_SHARED] + cached;
+    kprintf("VMSTAT Mappings per Cached Text Page = %d.%02d\n",
+      shared / cached, (shared % cached) * 100 / cached);
+  }
+
+  /* Extra entries that were not missed on again may each have saved a fault */
+  around = counts[VMSTAT_TLB_FAULTAROUND];
+  if (around > 0) {
+    kept = around - counts[VMSTAT_TLB_FAULTAROUND_MISS];
+    kprintf("VMSTAT TLB Fault-around Entries - Misses = %d (%d%%)\n",
+      kept, kept * 100 / around);
+  }
+
+  /* How many TLB misses each address space switch costs, to two places */
+  switches = counts[VMSTAT_AS_SWITCH];
+  if (switches > 0) {
+    kprintf("VMSTAT TLB Faults per Address Space Switch = %d.%02d\n",
+      tlb_faults / switches, (tlb_faults % switches) * 100 / switches);
   }
 }
 /* ---------------------------------------------------------------------- */
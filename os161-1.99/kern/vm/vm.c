@@ -0,0 +1,678 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <spl.h>
+#include <proc.h>
+#include <current.h>
+#include <cpu.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <asid.h>
+#include <swap.h>
+#include <textcache.h>
+#include <zeropool.h>
+#include <uw-vmstats.h>
+
+/*
+ * Paged VM system.
+ *
+ * Each address space has its own page table (see pagetable.h). A page
+ * gets a frame the first time it is touched, so user memory no longer
+ * has to be physically contiguous. Pages of the executable are read
+ * from the file on that first touch too, so exec does no I/O up front.
+ *
+ * Pages shared copy-on-write after fork are mapped read-only in the
+ * TLB even in writable regions. The resulting VM_FAULT_READONLY is
+ * where the page gets its private copy.
+ *
+ * Clean pages in writable regions are also mapped read-only at first,
+ * so that the first write is seen and the page marked PTE_DIRTY. When
+ * memory runs out a page is chosen with the clock algorithm (see
+ * coremap_victim); only dirty pages are written to swap.
+ *
+ * Pages that need zeroing take a frame from the pool that a kernel
+ * thread keeps zeroed in idle time (see zeropool.h), if it has one.
+ */
+
+struct lock *vm_lock;
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+
+	vm_lock = lock_create("vm");
+	if (vm_lock == NULL) {
+		panic("vm_bootstrap: lock_create failed\n");
+	}
+
+	vmstats_init();
+	textcache_bootstrap();
+	swap_bootstrap();
+	zeropool_bootstrap();
+}
+
+/*
+ * TLB shootdown requests from other CPUs (see asid_shootdown). These
+ * run in the IPI handler, with interrupts off.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	tlb_invalidate_all();
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	asid_tlb_drop(ts->ts_addrspace, ts->ts_vaddr);
+}
+
+/*
+ * Lowest address the stack of AS may grow down to: VM_STACKMAXPAGES
+ * below USERSTACK, but leaving an unmapped guard page above the
+ * highest region.
+ */
+static
+vaddr_t
+vm_stacklimit(struct addrspace *as)
+{
+	struct region *rg;
+	vaddr_t limit;
+	unsigned n;
+
+	limit = USERSTACK - VM_STACKMAXPAGES * PAGE_SIZE;
+	n = array_num(&as->as_regions);
+	if (n > 0) {
+		/* The regions are sorted, so the last one is highest */
+		rg = array_get(&as->as_regions, n - 1);
+		if (RG_END(rg) + PAGE_SIZE > limit) {
+			limit = RG_END(rg) + PAGE_SIZE;
+		}
+	}
+	return limit;
+}
+
+/*
+ * Find the region containing VADDR. Sets *RGP to the region (NULL for
+ * the heap and stack) and *WRITEABLE to whether user writes are allowed
+ * there. A fault below the bottom of the stack grows it, within its
+ * limit. Returns EFAULT if VADDR is not mapped or may not be touched.
+ */
+static
+int
+vm_findregion(struct addrspace *as, vaddr_t vaddr,
+	      struct region **rgp, bool *writeable)
+{
+	struct region *rg;
+
+	rg = as_region(as, vaddr);
+	if (rg != NULL) {
+		if (rg->rg_prot == PROT_NONE && as->elf_loaded) {
+			return EFAULT;
+		}
+		*rgp = rg;
+		*writeable = (rg->rg_prot & PROT_WRITE) || !as->elf_loaded;
+		return 0;
+	}
+
+	if (vaddr >= as->as_heapbase &&
+	    vaddr < ROUNDUP(as->as_heaptop, PAGE_SIZE)) {
+		*rgp = NULL;
+		*writeable = true;
+		return 0;
+	}
+
+	if (vaddr < USERSTACK && vaddr >= vm_stacklimit(as)) {
+		if (vaddr < as->as_stackbase) {
+			as->as_stackbase = vaddr & PAGE_FRAME;
+		}
+		*rgp = NULL;
+		*writeable = true;
+		return 0;
+	}
+
+	return EFAULT;
+}
+
+/*
+ * Work out which part [*LO, *HI) of the page at VADDR in region RG
+ * (NULL for the heap or stack) is backed by a file. Returns false if
+ * none of it is.
+ */
+static
+bool
+vm_filerange(struct region *rg, vaddr_t vaddr, vaddr_t *lo, vaddr_t *hi)
+{
+	if (rg == NULL || rg->rg_filesize == 0) {
+		return false;
+	}
+	*lo = vaddr > rg->rg_filevbase ? vaddr : rg->rg_filevbase;
+	*hi = vaddr + PAGE_SIZE;
+	if (*hi > rg->rg_filevbase + rg->rg_filesize) {
+		*hi = rg->rg_filevbase + rg->rg_filesize;
+	}
+	return *lo < *hi;
+}
+
+/*
+ * Fill the frame at PADDR with the contents of the page at VADDR in
+ * region RG (NULL for the heap or stack): whatever part of it is
+ * backed by a file is read in, and the rest is zeroed. ZEROED says
+ * the frame came from the zeroed pool and needs no clearing.
+ */
+static
+int
+vm_fillpage(struct region *rg, vaddr_t vaddr, paddr_t paddr, bool zeroed)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t kva = PADDR_TO_KVADDR(paddr);
+	vaddr_t lo, hi;
+	int result;
+
+	if (!vm_filerange(rg, vaddr, &lo, &hi)) {
+		if (!zeroed) {
+			bzero((void *)kva, PAGE_SIZE);
+		}
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		return 0;
+	}
+
+	/* Clear only what the file does not cover */
+	if (!zeroed) {
+		bzero((void *)kva, lo - vaddr);
+		bzero((void *)(kva + (hi - vaddr)), vaddr + PAGE_SIZE - hi);
+	}
+
+	KASSERT(rg->rg_vnode != NULL);
+	uio_kinit(&iov, &ku, (void *)(kva + (lo - vaddr)),
+		  hi - lo, rg->rg_offset + (lo - rg->rg_filevbase), UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0 && rg->rg_mmapflags == 0) {
+		kprintf("vm: short read on executable - file truncated?\n");
+		return ENOEXEC;
+	}
+	/* A mapped file may have shrunk; the rest reads as zeroes */
+	if (ku.uio_resid != 0 && !zeroed) {
+		bzero((void *)(kva + (hi - vaddr) - ku.uio_resid),
+		      ku.uio_resid);
+	}
+
+	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	vmstats_inc(rg->rg_mmapflags == 0 ?
+		    VMSTAT_ELF_FILE_READ : VMSTAT_MMAP_FILE_READ);
+	return 0;
+}
+
+/*
+ * Evict one user page chosen by the clock algorithm. Dirty pages are
+ * written to swap, or back to their file if they are in a shared
+ * mapping; clean ones are dropped and will be refilled from their file
+ * or zeroed when next touched.
+ *
+ * The clock hand runs under the coremap spinlock and cannot wait for
+ * other CPUs, so it only clears reference bits in this CPU's TLB. A
+ * page in use elsewhere may therefore look idle; the eviction itself
+ * is shot down on every CPU.
+ */
+static
+int
+vm_pageout(void)
+{
+	struct addrspace *as;
+	struct region *rg;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	pte_t *pte;
+	unsigned slot;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	paddr = coremap_victim(asid_tlb_drop, &as, &vaddr);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & PTE_VALID) && (*pte & PTE_FRAME) == paddr);
+
+	/* No writes may sneak in while the page is on its way out */
+	asid_shootdown(as, &vaddr, 1);
+
+	rg = as_region(as, vaddr);
+	if ((*pte & PTE_DIRTY) && rg != NULL && rg->rg_mmapflags == MAP_SHARED) {
+		result = as_writepage(rg, vaddr, paddr);
+		if (result) {
+			coremap_mapped(paddr, as, vaddr);
+			return result;
+		}
+		*pte = 0;
+	}
+	else if (*pte & PTE_DIRTY) {
+		result = swap_alloc(&slot);
+		if (result) {
+			coremap_mapped(paddr, as, vaddr);
+			return result;
+		}
+		result = swap_out(slot, paddr);
+		if (result) {
+			swap_free(slot);
+			coremap_mapped(paddr, as, vaddr);
+			return result;
+		}
+		*pte = PTE_MKSWAP(slot);
+	}
+	else {
+		*pte = 0;
+	}
+
+	freeppages(paddr);
+	return 0;
+}
+
+/*
+ * Get a frame for a user page, paging something else out if memory is
+ * full. Returns 0 if that is not possible.
+ */
+static
+paddr_t
+vm_getpage(void)
+{
+	paddr_t paddr;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	while ((paddr = getppages(1)) == 0) {
+		/* Pooled zero frames and unused cached text cost least */
+		if (zeropool_reclaim() || textcache_reclaim()) {
+			continue;
+		}
+		if (!swap_enabled() || vm_pageout() != 0) {
+			return 0;
+		}
+	}
+	return paddr;
+}
+
+/*
+ * Make the page behind PTE resident: from swap if it was paged out,
+ * from the text cache if it is program text some process has already
+ * read, and otherwise with vm_fillpage.
+ */
+static
+int
+vm_pagein(struct region *rg, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t paddr;
+	vaddr_t lo, hi;
+	off_t offset = 0;
+	bool filebacked, shareable, zeroed;
+	unsigned slot;
+	int result;
+
+	if (*pte & PTE_SWAPPED) {
+		paddr = vm_getpage();
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		slot = PTE_SLOT(*pte);
+		result = swap_in(slot, paddr);
+		if (result) {
+			freeppages(paddr);
+			return result;
+		}
+		swap_free(slot);
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+
+		/* The swap copy is gone, so this must be written out again */
+		*pte = paddr | PTE_VALID | PTE_DIRTY;
+		return 0;
+	}
+
+	filebacked = vm_filerange(rg, vaddr, &lo, &hi);
+
+	/* Only program text: mapped files can change underneath us */
+	shareable = filebacked && rg->rg_mmapflags == 0 &&
+		(rg->rg_prot & PROT_WRITE) == 0;
+	if (shareable) {
+		offset = rg->rg_offset + (lo - rg->rg_filevbase);
+		paddr = textcache_lookup(rg->rg_vnode, offset,
+					 lo - vaddr, hi - lo);
+		if (paddr != 0) {
+			vmstats_inc(VMSTAT_PAGE_FAULT_SHARED);
+			*pte = paddr | PTE_VALID;
+			return 0;
+		}
+	}
+
+	/* Any page that is not all file contents can use a zeroed frame */
+	paddr = 0;
+	if (!filebacked || hi - lo < PAGE_SIZE) {
+		paddr = zeropool_get();
+	}
+	zeroed = paddr != 0;
+	if (!zeroed) {
+		paddr = vm_getpage();
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+	}
+
+	result = vm_fillpage(rg, vaddr, paddr, zeroed);
+	if (result) {
+		freeppages(paddr);
+		return result;
+	}
+	if (shareable) {
+		textcache_insert(rg->rg_vnode, offset, lo - vaddr, hi - lo,
+				 paddr);
+	}
+	*pte = paddr | PTE_VALID;
+	return 0;
+}
+
+/*
+ * Give the page behind PTE, VADDR in AS, its own frame before it is
+ * written. If no one else refers to the frame any more it can simply
+ * be taken over.
+ */
+static
+int
+vm_cowbreak(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpa, newpa;
+
+	KASSERT(*pte & PTE_COW);
+	oldpa = *pte & PTE_FRAME;
+
+	if (coremap_refcount(oldpa) == 1) {
+		*pte &= ~PTE_COW;
+		return 0;
+	}
+
+	newpa = vm_getpage();
+	if (newpa == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	*pte = newpa | PTE_VALID;
+
+	/* Other CPUs may still map the shared frame read-only */
+	asid_shootdown(as, &vaddr, 1);
+	freeppages(oldpa);
+	return 0;
+}
+
+/*
+ * Fault-around. With vm_faultaround set to N > 1, a TLB miss also loads
+ * entries for the other resident pages in the N-page aligned block
+ * around the fault that lie in the same region (or in the heap or
+ * stack, if that is where the fault was). Nothing is paged in for them.
+ *
+ * The TLB has no reference bits, so we cannot tell whether an extra
+ * entry gets used. Each CPU instead remembers the last NUM_TLB it
+ * loaded; a later miss on one of those is counted as a fault-around
+ * miss. Extra entries minus misses is thus the most misses the window
+ * could have saved.
+ */
+unsigned vm_faultaround = 0;
+
+struct faultaround_cpu {
+	uint32_t fc_recent[NUM_TLB];	/* EntryHi of recent extra entries */
+	unsigned fc_next;		/* where the next one goes */
+};
+
+static struct faultaround_cpu faultaround_cpus[ASID_MAXCPUS];
+
+/*
+ * Was the page behind EHI loaded by fault-around recently? Forgets it
+ * if so. Call with interrupts off.
+ */
+static
+bool
+vm_faultaround_miss(uint32_t ehi)
+{
+	struct faultaround_cpu *fc = &faultaround_cpus[curcpu->c_number];
+	unsigned i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		if (fc->fc_recent[i] == ehi) {
+			fc->fc_recent[i] = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Load TLB entries for the resident neighbours of FAULTADDRESS, which
+ * is in RG (NULL for the heap or stack). Returns how many were loaded.
+ * Call with vm_lock held and interrupts off.
+ */
+static
+unsigned
+vm_faultaround_load(struct addrspace *as, struct region *rg,
+		    vaddr_t faultaddress, bool writeable)
+{
+	struct faultaround_cpu *fc = &faultaround_cpus[curcpu->c_number];
+	vaddr_t lo, hi, va, size;
+	uint32_t ehi, elo;
+	pte_t *pte;
+	unsigned n = 0;
+
+	/* The menu may change it under us */
+	size = vm_faultaround * PAGE_SIZE;
+	if (size <= PAGE_SIZE) {
+		return 0;
+	}
+
+	if (rg != NULL) {
+		lo = rg->rg_vbase;
+		hi = RG_END(rg);
+	}
+	else if (faultaddress >= as->as_heapbase &&
+		 faultaddress < ROUNDUP(as->as_heaptop, PAGE_SIZE)) {
+		lo = as->as_heapbase;
+		hi = ROUNDUP(as->as_heaptop, PAGE_SIZE);
+	}
+	else {
+		lo = as->as_stackbase;
+		hi = USERSTACK;
+	}
+
+	va = faultaddress & ~(size - 1);
+	if (va > lo) {
+		lo = va;
+	}
+	if (va + size < hi) {
+		hi = va + size;
+	}
+
+	for (va = lo; va < hi; va += PAGE_SIZE) {
+		if (va == faultaddress) {
+			continue;
+		}
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || (*pte & PTE_VALID) == 0) {
+			continue;
+		}
+		ehi = asid_entryhi(as, va);
+		if (tlb_probe(ehi, 0) >= 0) {
+			continue;
+		}
+
+		elo = (*pte & PTE_FRAME) | TLBLO_VALID;
+		if (writeable &&
+		    (*pte & (PTE_COW | PTE_DIRTY)) == PTE_DIRTY) {
+			elo |= TLBLO_DIRTY;
+		}
+
+		/* Keep the clock from taking a page we just put in the TLB */
+		coremap_mapped(*pte & PTE_FRAME, as, va);
+		tlb_insert(ehi, elo);
+
+		fc->fc_recent[fc->fc_next] = ehi;
+		fc->fc_next = (fc->fc_next + 1) % NUM_TLB;
+		n++;
+	}
+	return n;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	bool writeable, freeslot, missed;
+	paddr_t paddr;
+	pte_t *pte;
+	uint32_t ehi, elo;
+	unsigned extra;
+	int i, spl, result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	result = vm_findregion(as, faultaddress, &rg, &writeable);
+	if (result) {
+		return result;
+	}
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		return EFAULT;
+	}
+
+	if (faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(VMSTAT_TLB_FAULT);
+	}
+
+	/* Held until the TLB entry is in, so pageout cannot race us */
+	lock_acquire(vm_lock);
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(vm_lock);
+		return ENOMEM;
+	}
+
+	if ((*pte & PTE_VALID) == 0) {
+		result = vm_pagein(rg, faultaddress, pte);
+		if (result) {
+			lock_release(vm_lock);
+			return result;
+		}
+	}
+	else if (faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+	}
+
+	if (faulttype != VM_FAULT_READ) {
+		if (*pte & PTE_COW) {
+			result = vm_cowbreak(as, faultaddress, pte);
+			if (result) {
+				lock_release(vm_lock);
+				return result;
+			}
+		}
+		*pte |= PTE_DIRTY;
+	}
+	paddr = *pte & PTE_FRAME;
+
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	coremap_mapped(paddr, as, faultaddress);
+
+	elo = paddr | TLBLO_VALID;
+	if (writeable && (*pte & (PTE_COW | PTE_DIRTY)) == PTE_DIRTY) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	/* Entries are tagged with our ASID; see asid.h */
+	ehi = asid_entryhi(as, faultaddress);
+
+	/* Replace the stale read-only entry if there is one. */
+	if (faulttype == VM_FAULT_READONLY) {
+		i = tlb_probe(ehi, 0);
+		if (i >= 0) {
+			tlb_write(ehi, elo, i);
+			splx(spl);
+			lock_release(vm_lock);
+			return 0;
+		}
+	}
+
+	/*
+	 * Neighbours go in first, so that they cannot push out the
+	 * entry this fault is for.
+	 */
+	missed = false;
+	extra = 0;
+	if (vm_faultaround > 1 && faulttype != VM_FAULT_READONLY &&
+	    as->elf_loaded) {
+		missed = vm_faultaround_miss(ehi);
+		extra = vm_faultaround_load(as, rg, faultaddress, writeable);
+	}
+
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	freeslot = tlb_insert(ehi, elo);
+	splx(spl);
+	lock_release(vm_lock);
+
+	if (faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(freeslot ? VMSTAT_TLB_FAULT_FREE :
+			    VMSTAT_TLB_FAULT_REPLACE);
+	}
+	if (missed) {
+		vmstats_inc(VMSTAT_TLB_FAULTAROUND_MISS);
+	}
+	while (extra-- > 0) {
+		vmstats_inc(VMSTAT_TLB_FAULTAROUND);
+	}
+	return 0;
+}
@@ -0,0 +1,150 @@
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <vm.h>
+#include <coremap.h>
+#include <zeropool.h>
+#include <uw-vmstats.h>
+
+/*
+ * The pool is a stack of frames. Once full, the thread sleeps until it
+ * has been drawn down to half, so that it refills in batches.
+ */
+
+#define ZP_SIZE    32		/* frames kept zeroed */
+#define ZP_RESERVE 64		/* free frames left for everyone else */
+
+static paddr_t zp_frames[ZP_SIZE];
+static unsigned zp_count;
+
+static struct lock *zp_lock;
+static struct cv *zp_cv;
+
+/*
+ * Zero one frame and add it to the pool, if the pool needs it and
+ * there is memory to spare. Returns false if the thread should back
+ * off instead.
+ */
+static
+bool
+zeropool_fill(void)
+{
+	paddr_t paddr;
+
+	if (coremap_nfree() < ZP_RESERVE) {
+		return false;
+	}
+	paddr = getppages(1);
+	if (paddr == 0) {
+		return false;
+	}
+	bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+
+	lock_acquire(zp_lock);
+	if (zp_count < ZP_SIZE) {
+		zp_frames[zp_count++] = paddr;
+		paddr = 0;
+	}
+	lock_release(zp_lock);
+
+	if (paddr != 0) {
+		freeppages(paddr);
+	}
+	return true;
+}
+
+static
+void
+zeropool_thread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (1) {
+		lock_acquire(zp_lock);
+		while (zp_count == ZP_SIZE) {
+			cv_wait(zp_cv, zp_lock);
+		}
+		lock_release(zp_lock);
+
+		/* Only use time nobody else wants */
+		if (thread_cpu_busy()) {
+			thread_yield();
+			continue;
+		}
+		if (!zeropool_fill()) {
+			clocksleep(1);
+		}
+	}
+}
+
+void
+zeropool_bootstrap(void)
+{
+	int result;
+
+	zp_lock = lock_create("zeropool");
+	zp_cv = cv_create("zeropool");
+	if (zp_lock == NULL || zp_cv == NULL) {
+		panic("zeropool_bootstrap: out of memory\n");
+	}
+	zp_count = 0;
+
+	result = thread_fork("zeropool", NULL, zeropool_thread, NULL, 0);
+	if (result) {
+		panic("zeropool_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+/*
+ * Take the top frame off the pool, waking the thread if the pool has
+ * run down. Call with zp_lock held.
+ */
+static
+paddr_t
+zeropool_pop(void)
+{
+	paddr_t paddr;
+
+	KASSERT(lock_do_i_hold(zp_lock));
+	if (zp_count == 0) {
+		return 0;
+	}
+	paddr = zp_frames[--zp_count];
+	if (zp_count <= ZP_SIZE / 2) {
+		cv_signal(zp_cv, zp_lock);
+	}
+	return paddr;
+}
+
+paddr_t
+zeropool_get(void)
+{
+	paddr_t paddr;
+
+	lock_acquire(zp_lock);
+	paddr = zeropool_pop();
+	lock_release(zp_lock);
+
+	vmstats_inc(paddr != 0 ? VMSTAT_ZEROPOOL_HIT : VMSTAT_ZEROPOOL_MISS);
+	return paddr;
+}
+
+bool
+zeropool_reclaim(void)
+{
+	paddr_t paddr;
+
+	lock_acquire(zp_lock);
+	paddr = zeropool_pop();
+	lock_release(zp_lock);
+
+	if (paddr == 0) {
+		return false;
+	}
+	freeppages(paddr);
+	return true;
+}
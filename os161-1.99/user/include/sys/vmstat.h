@@ -0,0 +1,14 @@
+#ifndef _SYS_VMSTAT_H_
+#define _SYS_VMSTAT_H_
+
+#include <sys/types.h>
+#include <kern/vmstat.h>
+
+/*
+ * Fill in *VS for the process with the lowest pid that is at least
+ * PID, or with PID 0 for the whole system. Fails with ESRCH when
+ * there is no such process.
+ */
+int vmstat(pid_t pid, struct vmstat *vs);
+
+#endif /* _SYS_VMSTAT_H_ */
@@ -0,0 +1,89 @@
+/*
+ * tlbbench - measure the cost of a TLB miss.
+ *
+ * Touches one word in each of N pages, over and over. With N well
+ * above the 64 TLB entries nearly every touch is a miss; with a few
+ * pages none of them are. The difference in time per touch between
+ * the two runs is what a miss costs. The pages are touched once
+ * before timing so that page faults are not counted.
+ *
+ * Usage: tlbbench [npages [rounds]]
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE_SIZE 4096
+#define MAXPAGES 256
+#define SMALLPAGES 16
+#define DEFAULT_PAGES 128
+#define DEFAULT_ROUNDS 1000
+
+static volatile int pages[MAXPAGES][PAGE_SIZE / sizeof(int)];
+
+static
+unsigned long
+elapsed(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	return (unsigned long)(s1 - s0) * 1000000 + ns1 / 1000 - ns0 / 1000;
+}
+
+/*
+ * Touch NPAGES pages ROUNDS times. Returns nanoseconds per touch.
+ */
+static
+unsigned long
+run(unsigned npages, unsigned rounds)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1, us, touches;
+	unsigned i, r;
+
+	for (i = 0; i < npages; i++) {
+		pages[i][0] = i;
+	}
+
+	__time(&s0, &ns0);
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < npages; i++) {
+			pages[i][0]++;
+		}
+	}
+	__time(&s1, &ns1);
+
+	us = elapsed(s0, ns0, s1, ns1);
+	touches = (unsigned long)npages * rounds;
+	/* rounds is always a multiple of 1000 */
+	return us / (touches / 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned npages = DEFAULT_PAGES, rounds = DEFAULT_ROUNDS;
+	unsigned long hit, miss;
+
+	if (argc > 1) {
+		npages = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		rounds = atoi(argv[2]);
+	}
+	if (npages <= SMALLPAGES || npages > MAXPAGES || rounds == 0) {
+		errx(1, "usage: tlbbench [npages [rounds]], %d < npages <= %d",
+		     SMALLPAGES, MAXPAGES);
+	}
+	/* keep both runs a whole number of thousands of touches */
+	rounds = (rounds + 999) / 1000 * 1000;
+
+	hit = run(SMALLPAGES, rounds * (npages / SMALLPAGES));
+	miss = run(npages, rounds);
+
+	printf("tlbbench: %u pages: %lu ns per touch\n", SMALLPAGES, hit);
+	printf("tlbbench: %u pages: %lu ns per touch\n", npages, miss);
+	printf("tlbbench: about %lu ns per TLB miss\n",
+	       miss > hit ? miss - hit : 0);
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * vmtop - print a snapshot of virtual memory use.
+ *
+ * One line for the whole system, then one for each process, with the
+ * TLB misses it has taken, how they were satisfied, the pages it has
+ * pushed out to swap, and how many of its pages are in memory and in
+ * swap right now. Run it in the background next to something that
+ * pages (e.g. "p /testbin/huge &") to see where the faults go.
+ *
+ * Usage: vmtop
+ */
+
+#include <sys/vmstat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+static
+void
+printrow(const struct vmstat *vs)
+{
+	printf("%5d %-15s %8u %8u %7u %7u %7u %7u %7u %6u %6u\n",
+	       vs->vs_pid, vs->vs_name,
+	       vs->vs_tlbfaults, vs->vs_tlbreloads, vs->vs_zerofaults,
+	       vs->vs_filefaults, vs->vs_sharedfaults, vs->vs_swapins,
+	       vs->vs_swapouts, vs->vs_resident, vs->vs_swapped);
+}
+
+int
+main(void)
+{
+	struct vmstat vs;
+	pid_t pid;
+
+	if (vmstat(0, &vs)) {
+		err(1, "vmstat");
+	}
+
+	printf("%5s %-15s %8s %8s %7s %7s %7s %7s %7s %6s %6s\n",
+	       "PID", "NAME", "TLBMISS", "RELOAD", "ZERO", "FILE",
+	       "SHARED", "SWPIN", "SWPOUT", "RES", "SWAP");
+	printrow(&vs);
+
+	/* each call hands back the next live process at or after pid */
+	pid = 1;
+	while (vmstat(pid, &vs) == 0) {
+		printrow(&vs);
+		pid = vs.vs_pid + 1;
+	}
+	return 0;
+}
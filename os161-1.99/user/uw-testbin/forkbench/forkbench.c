@@ -0,0 +1,78 @@
+/*
+ * forkbench - measure fork latency.
+ *
+ *  The parent first touches every page of a large data array so that it
+ *  has a sizeable resident address space, then forks NFORKS children one
+ *  at a time.  Each child exits immediately (the common fork-then-exec
+ *  case), and the parent waits for it before forking the next one.
+ *
+ *  Prints the total time and the average time per fork/exit/wait round
+ *  trip.  Run it before and after a change to the fork path to compare;
+ *  with copy-on-write fork the cost should no longer grow with the size
+ *  of the parent's address space.
+ *
+ *  An optional argument gives the number of forks to do.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE_SIZE 4096
+#define DATAPAGES 128
+#define NFORKS 100
+
+static char data[DATAPAGES * PAGE_SIZE];
+
+int
+main(int argc, char *argv[])
+{
+  int nforks = NFORKS;
+  int i, status;
+  pid_t pid;
+  time_t s0, s1;
+  unsigned long ns0, ns1;
+  unsigned long elapsed;
+
+  if (argc > 1) {
+    nforks = atoi(argv[1]);
+    if (nforks <= 0) {
+      errx(1,"usage: forkbench [nforks]");
+    }
+  }
+
+  /* make every data page resident so fork has something to copy */
+  for (i = 0; i < DATAPAGES; i++) {
+    data[i * PAGE_SIZE] = (char)i;
+  }
+
+  __time(&s0, &ns0);
+  for (i = 0; i < nforks; i++) {
+    pid = fork();
+    if (pid < 0) {
+      err(1,"fork");
+    }
+    if (pid == 0) {
+      _exit(0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+      err(1,"waitpid");
+    }
+  }
+  __time(&s1, &ns1);
+
+  elapsed = (unsigned long)(s1 - s0) * 1000000 + ns1 / 1000 - ns0 / 1000;
+
+  /* make sure the parent's pages survived the children */
+  for (i = 0; i < DATAPAGES; i++) {
+    if (data[i * PAGE_SIZE] != (char)i) {
+      errx(1,"data page %d corrupted",i);
+    }
+  }
+
+  printf("forkbench: %d forks, %d data pages\n", nforks, DATAPAGES);
+  printf("forkbench: total %lu us, %lu us per fork\n",
+         elapsed, elapsed / nforks);
+  return 0;
+}